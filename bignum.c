@@ -0,0 +1,250 @@
+#include <stdlib.h>
+#include <string.h>
+#include "alloc.h"
+#include "bignum.h"
+
+/* below this many limbs in the shorter operand, schoolbook
+   multiplication beats splitting */
+#define KARATSUBA_THRESHOLD 32
+
+#define LIMB_MASK 0xFFFFFFFFULL
+
+size_t mag_length(const limb_t *a, size_t n) {
+  while (n > 0 && a[n - 1] == 0)
+    n--;
+  return n;
+}
+
+int mag_cmp(const limb_t *a, size_t an, const limb_t *b, size_t bn) {
+  an = mag_length(a, an), bn = mag_length(b, bn);
+  if (an != bn)
+    return an < bn ? -1 : 1;
+  while (an-- > 0) {
+    if (a[an] != b[an])
+      return a[an] < b[an] ? -1 : 1;
+  }
+  return 0;
+}
+
+void mag_add(limb_t *r, const limb_t *a, size_t an, const limb_t *b, size_t bn) {
+  uint64_t carry = 0;
+  size_t i;
+  if (an < bn) {
+    const limb_t *t = a;
+    a = b, b = t;
+    i = an, an = bn, bn = i;
+  }
+  for (i = 0; i < bn; i++) {
+    carry += (uint64_t) a[i] + b[i];
+    r[i] = (limb_t) carry;
+    carry >>= LIMB_BITS;
+  }
+  for (; i < an; i++) {
+    carry += a[i];
+    r[i] = (limb_t) carry;
+    carry >>= LIMB_BITS;
+  }
+  r[an] = (limb_t) carry;
+}
+
+void mag_sub(limb_t *r, const limb_t *a, size_t an, const limb_t *b, size_t bn) {
+  uint64_t d;
+  limb_t borrow = 0;
+  size_t i;
+  bn = mag_length(b, bn);
+  for (i = 0; i < bn; i++) {
+    d = (uint64_t) a[i] - b[i] - borrow;
+    r[i] = (limb_t) d;
+    borrow = (d >> LIMB_BITS) & 1;
+  }
+  for (; i < an; i++) {
+    d = (uint64_t) a[i] - borrow;
+    r[i] = (limb_t) d;
+    borrow = (d >> LIMB_BITS) & 1;
+  }
+}
+
+/* r += t, where t is no longer than r, returning the carry */
+static limb_t add_into(limb_t *r, size_t rn, const limb_t *t, size_t tn) {
+  uint64_t carry = 0;
+  size_t i;
+  for (i = 0; i < tn; i++) {
+    carry += (uint64_t) r[i] + t[i];
+    r[i] = (limb_t) carry;
+    carry >>= LIMB_BITS;
+  }
+  for (; carry && i < rn; i++) {
+    carry += r[i];
+    r[i] = (limb_t) carry;
+    carry >>= LIMB_BITS;
+  }
+  return (limb_t) carry;
+}
+
+static void mul_basecase(limb_t *r, const limb_t *a, size_t an, const limb_t *b, size_t bn) {
+  uint64_t t;
+  limb_t carry;
+  size_t i, j;
+  memset(r, 0, (an + bn) * sizeof(limb_t));
+  for (i = 0; i < an; i++) {
+    carry = 0;
+    for (j = 0; j < bn; j++) {
+      t = (uint64_t) a[i] * b[j] + r[i + j] + carry;
+      r[i + j] = (limb_t) t;
+      carry = t >> LIMB_BITS;
+    }
+    r[i + bn] = carry;
+  }
+}
+
+static void mul(limb_t *r, const limb_t *a, size_t an, const limb_t *b, size_t bn);
+
+static inline void mul_any(limb_t *r, const limb_t *a, size_t an, const limb_t *b, size_t bn) {
+  if (an < bn)
+    mul(r, b, bn, a, an);
+  else
+    mul(r, a, an, b, bn);
+}
+
+/**
+ * Karatsuba: with a = a1 B^m + a0 and b = b1 B^m + b0, the middle of
+ * the product, a0 b1 + a1 b0, is (a0 + a1)(b0 + b1) - a0 b0 - a1 b1,
+ * so three half-size products do the work of four. Requires an >= bn.
+ */
+static void mul(limb_t *r, const limb_t *a, size_t an, const limb_t *b, size_t bn) {
+  size_t m = (an + 1) / 2, n;
+  limb_t *t, *sa, *sb, *z1;
+  if (bn < KARATSUBA_THRESHOLD) {
+    mul_basecase(r, a, an, b, bn);
+    return;
+  }
+  if (bn <= m) {
+    /* b is too short to split, so r = a0 b + (a1 b) B^m */
+    t = safe_malloc((an - m + bn) * sizeof(limb_t));
+    mul_any(r, a, m, b, bn);
+    memset(r + m + bn, 0, (an - m) * sizeof(limb_t));
+    mul_any(t, a + m, an - m, b, bn);
+    add_into(r + m, an + bn - m, t, an - m + bn);
+    free(t);
+    return;
+  }
+  t = safe_malloc((4 * m + 4) * sizeof(limb_t));
+  sa = t, sb = t + m + 1, z1 = t + 2 * m + 2;
+  mag_add(sa, a, m, a + m, an - m);
+  mag_add(sb, b, m, b + m, bn - m);
+  mul(z1, sa, m + 1, sb, m + 1);
+  mul(r, a, m, b, m);
+  mul(r + 2 * m, a + m, an - m, b + m, bn - m);
+  mag_sub(z1, z1, 2 * m + 2, r, 2 * m);
+  mag_sub(z1, z1, 2 * m + 2, r + 2 * m, an + bn - 2 * m);
+  n = mag_length(z1, 2 * m + 2);
+  add_into(r + m, an + bn - m, z1, n);
+  free(t);
+}
+
+void mag_mul(limb_t *r, const limb_t *a, size_t an, const limb_t *b, size_t bn) {
+  size_t n = an + bn;
+  an = mag_length(a, an), bn = mag_length(b, bn);
+  memset(r, 0, n * sizeof(limb_t));
+  if (an && bn)
+    mul_any(r, a, an, b, bn);
+}
+
+limb_t mag_divmod_1(limb_t *q, const limb_t *a, size_t n, limb_t d) {
+  uint64_t rem = 0;
+  while (n-- > 0) {
+    rem = (rem << LIMB_BITS) | a[n];
+    q[n] = (limb_t) (rem / d);
+    rem %= d;
+  }
+  return (limb_t) rem;
+}
+
+limb_t mag_muladd_1(limb_t *a, size_t n, limb_t m, limb_t c) {
+  uint64_t t, carry = c;
+  size_t i;
+  for (i = 0; i < n; i++) {
+    t = (uint64_t) a[i] * m + carry;
+    a[i] = (limb_t) t;
+    carry = t >> LIMB_BITS;
+  }
+  return (limb_t) carry;
+}
+
+static int leading_zeros(limb_t x) {
+  int n = 0;
+  for (; !(x & 0x80000000U); x <<= 1)
+    n++;
+  return n;
+}
+
+/* Knuth's algorithm D, on copies of a and b shifted so that the top
+   limb of b has its high bit set */
+void mag_divmod(limb_t *q, limb_t *r, const limb_t *a, size_t an,
+                const limb_t *b, size_t bn) {
+  limb_t *u, *v;
+  uint64_t qhat, rhat, p, base = LIMB_MASK + 1;
+  int64_t t, k;
+  size_t i, j;
+  int s;
+  if (bn == 1) {
+    limb_t rem = mag_divmod_1(q, a, an, b[0]);
+    if (r)
+      r[0] = rem;
+    return;
+  }
+  s = leading_zeros(b[bn - 1]);
+  u = safe_malloc((an + 1) * sizeof(limb_t));
+  v = safe_malloc(bn * sizeof(limb_t));
+  for (i = bn - 1; i > 0; i--)
+    v[i] = s ? (b[i] << s) | (b[i - 1] >> (LIMB_BITS - s)) : b[i];
+  v[0] = b[0] << s;
+  u[an] = s ? a[an - 1] >> (LIMB_BITS - s) : 0;
+  for (i = an - 1; i > 0; i--)
+    u[i] = s ? (a[i] << s) | (a[i - 1] >> (LIMB_BITS - s)) : a[i];
+  u[0] = a[0] << s;
+
+  for (j = an - bn + 1; j-- > 0;) {
+    /* estimate the quotient limb from the top two limbs, which is at
+       most two too large */
+    p = ((uint64_t) u[j + bn] << LIMB_BITS) | u[j + bn - 1];
+    qhat = p / v[bn - 1];
+    rhat = p % v[bn - 1];
+    while (qhat >= base ||
+           qhat * v[bn - 2] > ((rhat << LIMB_BITS) | u[j + bn - 2])) {
+      qhat--;
+      rhat += v[bn - 1];
+      if (rhat >= base)
+        break;
+    }
+    /* multiply and subtract */
+    k = 0;
+    for (i = 0; i < bn; i++) {
+      p = qhat * v[i];
+      t = u[i + j] - k - (int64_t) (p & LIMB_MASK);
+      u[i + j] = (limb_t) t;
+      k = (int64_t) (p >> LIMB_BITS) - (t >> LIMB_BITS);
+    }
+    t = u[j + bn] - k;
+    u[j + bn] = (limb_t) t;
+    q[j] = (limb_t) qhat;
+    if (t < 0) {
+      /* the estimate was one too large, so add b back */
+      q[j]--;
+      k = 0;
+      for (i = 0; i < bn; i++) {
+        t = (int64_t) u[i + j] + v[i] + k;
+        u[i + j] = (limb_t) t;
+        k = t >> LIMB_BITS;
+      }
+      u[j + bn] += (limb_t) k;
+    }
+  }
+  if (r) {
+    for (i = 0; i < bn - 1; i++)
+      r[i] = s ? (u[i] >> s) | (u[i + 1] << (LIMB_BITS - s)) : u[i];
+    r[bn - 1] = u[bn - 1] >> s;
+  }
+  free(u);
+  free(v);
+}
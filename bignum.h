@@ -0,0 +1,45 @@
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+#include <inttypes.h>
+#include <sys/types.h>
+
+/**
+ * Arithmetic on magnitudes: unsigned numbers held as arrays of 32-bit
+ * limbs, least significant first. Inputs may have zero limbs at the
+ * top; results are written in full and left for the caller to trim
+ * with mag_length. None of these allocate from the GC heap, though
+ * multiplication and division take scratch space with malloc.
+ */
+typedef uint32_t limb_t;
+
+#define LIMB_BITS 32
+
+/* the length of a once its high zero limbs are dropped */
+size_t mag_length(const limb_t *a, size_t n);
+
+int mag_cmp(const limb_t *a, size_t an, const limb_t *b, size_t bn);
+
+/* r has max(an, bn) + 1 limbs */
+void mag_add(limb_t *r, const limb_t *a, size_t an, const limb_t *b, size_t bn);
+
+/* a must be at least b; r has an limbs */
+void mag_sub(limb_t *r, const limb_t *a, size_t an, const limb_t *b, size_t bn);
+
+/* r has an + bn limbs and must not overlap a or b */
+void mag_mul(limb_t *r, const limb_t *a, size_t an, const limb_t *b, size_t bn);
+
+/**
+ * Divides a by b, which must have a non-zero top limb, with an >= bn.
+ * q has an - bn + 1 limbs and r, which may be NULL, has bn.
+ */
+void mag_divmod(limb_t *q, limb_t *r, const limb_t *a, size_t an,
+                const limb_t *b, size_t bn);
+
+/* q = a / d, returning the remainder; q may be a */
+limb_t mag_divmod_1(limb_t *q, const limb_t *a, size_t n, limb_t d);
+
+/* a = a * m + c, returning what carries out of the top limb */
+limb_t mag_muladd_1(limb_t *a, size_t n, limb_t m, limb_t c);
+
+#endif
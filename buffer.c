@@ -1,5 +1,6 @@
 #include <sys/types.h>
 #include <stdlib.h>
+#include <string.h>
 #include "alloc.h"
 #include "buffer.h"
 
@@ -17,9 +18,10 @@ buffer *allocbuffer(){
   return ptr;
 }
 
+/* doubles, so appending is amortized constant time */
 buffer *growbuffer(buffer *buf){
-  buf->size += BUFFER_STEP;
-  return safe_realloc(buf, buf->size);
+  buf->size *= 2;
+  return safe_realloc(buf, sizeof(buffer) + buf->size);
 }
 
 void freebuffer(buffer *buf){
@@ -33,10 +35,22 @@ int bufferlen(buffer *buf) {
 void bufferappend(buffer **buf, char ch){
   buffer *b = *buf;
   if(b->pos == b->size)
-    *buf = growbuffer(b);
+    b = *buf = growbuffer(b);
   b->data[b->pos++] = ch;
 }
 
+void bufferappendbytes(buffer **buf, const char *bytes, size_t n) {
+  buffer *b = *buf;
+  while (b->size - b->pos < n)
+    b = *buf = growbuffer(b);
+  memcpy(b->data + b->pos, bytes, n);
+  b->pos += n;
+}
+
+void bufferreset(buffer *buf) {
+  buf->pos = 0;
+}
+
 const char *bufferstring(buffer *buf) {
   return buf->data;
 }
@@ -1,6 +1,8 @@
 #ifndef BUFFER_H
 #define BUFFER_H
 
+#include <sys/types.h>
+
 typedef struct buffer buffer;
 
 buffer *allocbuffer();
@@ -9,6 +11,8 @@ void freebuffer(buffer *buf);
 
 int bufferlen(buffer *buf);
 void bufferappend(buffer **buf, char ch);
+void bufferappendbytes(buffer **buf, const char *bytes, size_t n);
+void bufferreset(buffer *buf);
 const char *bufferstring(buffer *buf);
 
 #endif
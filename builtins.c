@@ -1,123 +1,254 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include "env.h"
-#include "eval.h"
 #include "error.h"
 #include "builtins.h"
 #include "object.h"
+#include "print.h"
+#include "read.h"
+#include "wire.h"
 
-/* lisp objects for formal parameters */
-static ref_t sym_x, sym_y, sym_rest, formal_args[3], formal_rest[3];
+/**
+ * Builtins are called with their arguments in an array, one for each
+ * formal and then, if the builtin takes a rest, the list of the rest.
+ * They return their value.
+ */
 
-static void binary_integer_op(ref_t (*op)(ref_t, ref_t)) {
-  ref_t x = check_integer(lookup(sym_x)), y = check_integer(lookup(sym_y));
-  expr = op(x, y);
+/**
+ * Arithmetic folds its arguments from the left. Integers stay exact,
+ * but once a flonum turns up the rest of the fold is done in a double
+ * and only its result is boxed.
+ */
+enum op { ADD, SUB, MUL, DIV };
+
+static ref_t integer_op(enum op op, ref_t x, ref_t y) {
+  switch (op) {
+  case ADD: return integer_add(x, y);
+  case SUB: return integer_sub(x, y);
+  case MUL: return integer_mul(x, y);
+  default: return integer_div(x, y);
+  }
+}
+
+static double flonum_op(enum op op, double x, double y) {
+  switch (op) {
+  case ADD: return x + y;
+  case SUB: return x - y;
+  case MUL: return x * y;
+  default: return x / y;
+  }
+}
+
+static ref_t arithmetic(enum op op, ref_t *args) {
+  ref_t x = check_number(args[0]), y = check_number(args[1]), rest = args[2];
+  double acc;
+  while (isinteger(x) && isinteger(y)) {
+    x = integer_op(op, x, y);
+    if (isnil(rest))
+      return x;
+    y = check_number(car(rest)), rest = cdr(rest);
+  }
+  acc = flonum_op(op, numvalue(x), numvalue(y));
+  for (; !isnil(rest); rest = cdr(rest))
+    acc = flonum_op(op, acc, numvalue(check_number(car(rest))));
+  return flonum(acc);
+}
+
+static ref_t fn_add(ref_t *args) {
+  return arithmetic(ADD, args);
 }
 
-static void fn_add() {
-  binary_integer_op(integer_add);
+/* (append-string! BUILDER STRING & STRINGS) */
+static ref_t fn_append_string(ref_t *args) {
+  ref_t builder = check_builder(args[0]), rest;
+  builder_append(builder, flatten(args[1]));
+  for (rest = args[2]; !isnil(rest); rest = cdr(rest))
+    builder_append(builder, flatten(car(rest)));
+  return builder;
 }
 
-static void fn_car() {
-  expr = car(check_list(lookup(sym_x)));
+static ref_t fn_builder_string(ref_t *args) {
+  return flatten(check_builder(args[0]));
 }
 
-static void fn_cdr() {
-  expr = cdr(check_list(lookup(sym_x)));
+static ref_t fn_car(ref_t *args) {
+  return car(check_list(args[0]));
 }
 
-static void fn_cons() {
-  expr = cons(lookup(sym_x), lookup(sym_y));
+static ref_t fn_cdr(ref_t *args) {
+  return cdr(check_list(args[0]));
 }
 
-static void fn_div() {
-  binary_integer_op(integer_div);
+static ref_t fn_concat(ref_t *args) {
+  return concat(args[0]);
 }
 
-static void fn_eq() {
-  expr = (lookup(sym_x) == lookup(sym_y)) ? TRUE : NIL;
+static ref_t fn_cons(ref_t *args) {
+  return cons(args[0], args[1]);
 }
 
-static void fn_function() {
-  ref_t func = lookup(sym_x);
-  expr = issymbol(func) ? get_function(func) : check_function(func);
+static ref_t fn_div(ref_t *args) {
+  return arithmetic(DIV, args);
 }
 
-static void fn_list() {
-  expr = lookup(sym_rest);
+static ref_t fn_decode(ref_t *args) {
+  return decode(args[0]);
 }
 
-static void fn_macro() {
-  expr = set_type_macro(check_function(lookup(sym_x)));
+/* the first value encoded in a file, "-" being the standard input */
+static ref_t fn_decode_file(ref_t *args) {
+  const char *filename = strvalue(check_string(args[0]));
+  reader *in = openreader(filename);
+  ref_t value;
+  if (!in)
+    error("cannot open %s", filename);
+  value = decodefrom(in);
+  closereader(in);
+  if (value == UNBOUND)
+    error("nothing encoded in %s", filename);
+  return value;
 }
 
-static void fn_mul() {
-  binary_integer_op(integer_mul);
+static ref_t fn_encode(ref_t *args) {
+  return encode(args[0]);
 }
 
-static void fn_set_function() {
-  ref_t symbol = check_symbol(lookup(sym_x)), fn = check_function(lookup(sym_y));
+/* "-" is the standard output */
+static ref_t fn_encode_file(ref_t *args) {
+  const char *filename = strvalue(check_string(args[1]));
+  int fd = STDOUT_FILENO;
+  sink *out;
+  /* so that nothing is left open when it cannot be */
+  check_encodable(args[0]);
+  fflush(stdout);
+  if (strcmp("-", filename) && (fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+    error("cannot open %s", filename);
+  out = fdsink(fd);
+  encodeto(out, args[0]);
+  closesink(out);
+  if (fd != STDOUT_FILENO)
+    close(fd);
+  return args[0];
+}
+
+static ref_t fn_eq(ref_t *args) {
+  return (args[0] == args[1]) ? TRUE : NIL;
+}
+
+static ref_t fn_function(ref_t *args) {
+  ref_t func = args[0];
+  return issymbol(func) ? get_function(func) : check_function(func);
+}
+
+static ref_t fn_list(ref_t *args) {
+  return args[0];
+}
+
+static ref_t fn_macro(ref_t *args) {
+  return set_type_macro(check_function(args[0]));
+}
+
+static ref_t fn_mul(ref_t *args) {
+  return arithmetic(MUL, args);
+}
+
+static ref_t fn_set_function(ref_t *args) {
+  ref_t symbol = check_symbol(args[0]), fn = check_function(args[1]);
   set_function(symbol, fn);
-  expr = fn;
+  return fn;
 }
 
-static void fn_set_value() {
-  ref_t symbol = check_symbol(lookup(sym_x)), value = lookup(sym_y);
+static ref_t fn_set_value(ref_t *args) {
+  ref_t symbol = check_symbol(args[0]), value = args[1];
   set_value(symbol, value);
-  expr = value;
+  return value;
 }
 
-static void fn_sub() {
-  binary_integer_op(integer_sub);
+static ref_t fn_string_builder(ref_t *args) {
+  ref_t builder = string_builder(), rest;
+  for (rest = args[0]; !isnil(rest); rest = cdr(rest))
+    builder_append(builder, flatten(car(rest)));
+  return builder;
 }
 
-static void macro_defn() {
-  expr = cons(intern("set-function"),
-                      cons(cons(intern("quote"), cons(check_symbol(lookup(sym_x)), NIL)),
-                           cons(cons(intern("fn"), lookup(sym_rest)), NIL)));
+static ref_t fn_string_length(ref_t *args) {
+  ref_t str = args[0];
+  if (!isbuilder(str))
+    check_string(str);
+  return integer(string_length(str));
 }
 
-/* (set-function (quote CAR) (macro! (fn CDR))) */
-static void macro_defmacro() {
-  expr = cons(intern("set-function"),
-                      cons(cons(intern("quote"), cons(check_symbol(lookup(sym_x)), NIL)),
-                           cons(cons(intern("macro!"),
-                                     cons(cons(intern("fn"), lookup(sym_rest)), NIL)), NIL)));
+static ref_t fn_sub(ref_t *args) {
+  return arithmetic(SUB, args);
 }
 
-static inline ref_t formals(size_t arity, bool rest) {
-  return rest ? formal_rest[arity] : formal_args[arity];
+static size_t check_index(ref_t obj, size_t limit) {
+  if (!isfixnum(check_integer(obj)) || intvalue(obj) < 0 || intvalue(obj) > (int64_t) limit)
+    error("index out of range");
+  return intvalue(obj);
+}
+
+/* (substring STRING START [END]) */
+static ref_t fn_substring(ref_t *args) {
+  ref_t str = flatten(args[0]);
+  size_t size = string_length(str), start, end;
+  if (!isnil(args[2]) && !isnil(cdr(args[2])))
+    argument_error(2 + length(args[2]));
+  start = check_index(args[1], size);
+  end = isnil(args[2]) ? size : check_index(car(args[2]), size);
+  if (end < start)
+    error("index out of range");
+  return string_from_bytes(strvalue(str) + start, end - start);
+}
+
+static ref_t macro_defn(ref_t *args) {
+  return cons(intern("set-function"),
+              cons(cons(intern("quote"), cons(check_symbol(args[0]), NIL)),
+                   cons(cons(intern("fn"), args[1]), NIL)));
+}
+
+/* (set-function (quote CAR) (macro! (fn CDR))) */
+static ref_t macro_defmacro(ref_t *args) {
+  return cons(intern("set-function"),
+              cons(cons(intern("quote"), cons(check_symbol(args[0]), NIL)),
+                   cons(cons(intern("macro!"),
+                             cons(cons(intern("fn"), args[1]), NIL)), NIL)));
 }
 
 static inline void intern_function(const char *name, fn_t impl, size_t arity, bool rest) {
-  set_function(intern(name), builtin(formals(arity, rest), impl, arity, rest));
+  set_function(intern(name), builtin(impl, arity, rest));
 }
 
 static inline void intern_macro(const char *name, fn_t impl, size_t arity, bool rest) {
-  set_function(intern(name), set_type_macro(builtin(formals(arity, rest), impl, arity, sym_rest)));
+  set_function(intern(name), set_type_macro(builtin(impl, arity, rest)));
 }
 
 void init_builtins() {
-  sym_x = intern("x");
-  sym_y = intern("y");
-  sym_rest = intern("rest");
-  formal_args[0] = NIL;
-  formal_args[1] = cons(sym_x, NIL);
-  formal_args[2] = cons(sym_x, cons(sym_y, NIL));
-  formal_rest[0] = cons(sym_rest, NIL);
-  formal_rest[1] = cons(sym_x, cons(sym_rest, NIL));
-  formal_rest[2] = cons(sym_x, cons(sym_y, cons(sym_rest, NIL)));
-  intern_function("+", fn_add, 2, NO);
-  intern_function("-", fn_sub, 2, NO);
-  intern_function("*", fn_mul, 2, NO);
-  intern_function("/", fn_div, 2, NO);
+  intern_function("+", fn_add, 2, YES);
+  intern_function("-", fn_sub, 2, YES);
+  intern_function("*", fn_mul, 2, YES);
+  intern_function("/", fn_div, 2, YES);
+  intern_function("append-string!", fn_append_string, 2, YES);
+  intern_function("builder-string", fn_builder_string, 1, NO);
   intern_function("car", fn_car, 1, NO);
   intern_function("cdr", fn_cdr, 1, NO);
+  intern_function("concat", fn_concat, 0, YES);
   intern_function("cons", fn_cons, 2, NO);
+  intern_function("decode", fn_decode, 1, NO);
+  intern_function("decode-file", fn_decode_file, 1, NO);
+  intern_function("encode", fn_encode, 1, NO);
+  intern_function("encode-file", fn_encode_file, 2, NO);
   intern_function("eq", fn_eq, 2, NO);
   intern_function("function", fn_function, 1, NO);
   intern_function("macro!", fn_macro, 1, NO);
   intern_function("set-function", fn_set_function, 2, NO);
   intern_function("list", fn_list, 0, YES);
   intern_function("set-value", fn_set_value, 2, NO);
+  intern_function("string-builder", fn_string_builder, 0, YES);
+  intern_function("string-length", fn_string_length, 1, NO);
+  intern_function("substring", fn_substring, 2, YES);
 
   intern_macro("defn", macro_defn, 1, YES);
   intern_macro("defmacro", macro_defmacro, 1, YES);
@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include "alloc.h"
+#include "compile.h"
+#include "env.h"
+#include "error.h"
+#include "eval.h"
+#include "frame.h"
+#include "gc.h"
+#include "object.h"
+#include "vm.h"
+
+/* symbols we use in the code below, they are interned by init_compile */
+static ref_t sym_do, sym_fn, sym_if, sym_quote;
+
+/* the code being generated for one function body */
+struct unit {
+  int *ops;
+  size_t length, size;
+  ref_t consts, last;
+  size_t nconsts;
+};
+
+static void emit(struct unit *unit, int op) {
+  if (unit->length == unit->size) {
+    unit->size = unit->size ? unit->size * 2 : 64;
+    unit->ops = safe_realloc(unit->ops, unit->size * sizeof(int));
+  }
+  unit->ops[unit->length++] = op;
+}
+
+/* emits a jump target to be filled in by patch */
+static size_t emit_label(struct unit *unit) {
+  emit(unit, 0);
+  return unit->length - 1;
+}
+
+static void patch(struct unit *unit, size_t label) {
+  unit->ops[label] = unit->length;
+}
+
+static int constant(struct unit *unit, ref_t obj) {
+  ref_t cell = cons(obj, NIL);
+  if (isnil(unit->consts))
+    unit->consts = cell;
+  else
+    set_cdr(unit->last, cell);
+  unit->last = cell;
+  return unit->nconsts++;
+}
+
+/**
+ * A form is in tail position when nothing is left to do with its
+ * value but return it. Calls there are followed directly by
+ * OP_RETURN, which is how the VM knows it can reuse the caller's
+ * activation, so a branch of an if in tail position returns rather
+ * than jumping to the end.
+ */
+static void compile_form(struct unit *unit, ref_t form, ref_t scope, bool tail);
+
+static void compile_symbol(struct unit *unit, ref_t symbol, ref_t scope) {
+  int depth;
+  size_t index;
+  if (find_local(symbol, scope, &depth, &index))
+    emit(unit, OP_LOCAL), emit(unit, depth), emit(unit, index);
+  else
+    emit(unit, OP_GLOBAL), emit(unit, constant(unit, symbol));
+}
+
+static void compile_do(struct unit *unit, ref_t body, ref_t scope, bool tail) {
+  if (isnil(body)) {
+    emit(unit, OP_CONST), emit(unit, constant(unit, NIL));
+    return;
+  }
+  for (; !isnil(cdr(body)); body = cdr(body)) {
+    compile_form(unit, car(body), scope, NO);
+    emit(unit, OP_POP);
+  }
+  compile_form(unit, car(body), scope, tail);
+}
+
+static void compile_if(struct unit *unit, ref_t args, ref_t scope, bool tail) {
+  size_t len = length(args), otherwise, end;
+  if (len < 2 || 3 < len)
+    argument_error(len);
+  compile_form(unit, car(args), scope, NO);
+  emit(unit, OP_JUMP_IF_NIL), otherwise = emit_label(unit);
+  compile_form(unit, cadr(args), scope, tail);
+  if (tail)
+    emit(unit, OP_RETURN);
+  else
+    emit(unit, OP_JUMP), end = emit_label(unit);
+  patch(unit, otherwise);
+  compile_form(unit, caddr(args), scope, tail);
+  if (!tail)
+    patch(unit, end);
+}
+
+static void compile_fn(struct unit *unit, ref_t args, ref_t scope) {
+  size_t arity;
+  bool rest;
+  ref_t formals = parse_formals(car(args), &arity, &rest), body = cdr(args);
+  ref_t tmpl = template(formals, body, arity, rest);
+  set_code(tmpl, compile(cons(sym_do, body), extend_scope(formals, scope)));
+  emit(unit, OP_CLOSURE), emit(unit, constant(unit, tmpl));
+}
+
+static void compile_quote(struct unit *unit, ref_t args) {
+  size_t len = length(args);
+  if (len != 1)
+    argument_error(len);
+  emit(unit, OP_CONST), emit(unit, constant(unit, car(args)));
+}
+
+/* whether the head names a macro is only decided when the call runs */
+static void compile_call(struct unit *unit, ref_t form, ref_t scope) {
+  ref_t args;
+  size_t end, n = 0;
+  check_symbol(car(form));
+  emit(unit, OP_FUNCTION), emit(unit, constant(unit, site(form, scope)));
+  end = emit_label(unit);
+  for (args = cdr(form); !isnil(args); args = cdr(args), n++)
+    compile_form(unit, car(args), scope, NO);
+  emit(unit, OP_CALL), emit(unit, n);
+  patch(unit, end);
+}
+
+static void compile_form(struct unit *unit, ref_t form, ref_t scope, bool tail) {
+  ref_t head;
+  if (issymbol(form))
+    compile_symbol(unit, form, scope);
+  else if (!iscons(form))
+    emit(unit, OP_CONST), emit(unit, constant(unit, form));
+  else if ((head = car(form)) == sym_do)
+    compile_do(unit, cdr(form), scope, tail);
+  else if (head == sym_fn)
+    compile_fn(unit, cdr(form), scope);
+  else if (head == sym_if)
+    compile_if(unit, cdr(form), scope, tail);
+  else if (head == sym_quote)
+    compile_quote(unit, cdr(form));
+  else
+    compile_call(unit, form, scope);
+}
+
+ref_t compile(ref_t form, ref_t scope) {
+  struct unit unit = { NULL, 0, 0, NIL, NIL, 0 };
+  ref_t consts, code;
+  size_t i;
+  compile_form(&unit, form, scope, YES);
+  emit(&unit, OP_RETURN);
+  consts = vector(unit.nconsts, NIL);
+  for (i = 0; i < unit.nconsts; i++, unit.consts = cdr(unit.consts))
+    vector_set(consts, i, car(unit.consts));
+  code = bytecode(unit.ops, unit.length, consts);
+  free(unit.ops);
+  return code;
+}
+
+void init_compile() {
+  intern_static(&sym_do, "do");
+  intern_static(&sym_fn, "fn");
+  intern_static(&sym_if, "if");
+  intern_static(&sym_quote, "quote");
+}
@@ -0,0 +1,15 @@
+#ifndef COMPILE_H
+#define COMPILE_H
+
+#include "types.h"
+
+void init_compile();
+
+/**
+ * Compiles form into bytecode that returns its value. The scope is a
+ * list of the formals of each frame enclosing the form, innermost
+ * first, as it will be when the code runs.
+ */
+ref_t compile(ref_t form, ref_t scope);
+
+#endif
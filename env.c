@@ -4,32 +4,82 @@
 #include "alloc.h"
 #include "env.h"
 #include "error.h"
+#include "gc.h"
 #include "object.h"
 
 #include "print.h"
 
+/* The symbol table is an open-addressed hash table kept in a vector,
+   with NIL marking the empty slots. It is resized to keep it no more
+   than half full, so probe sequences stay short. */
+#define INITIAL_SYMBOLS 512
+
 ref_t symbol_table = NIL;
+static size_t symbol_count = 0;
+
+/* the C variables intern_static has filled in */
+#define MAX_STATICS 32
+static struct {
+  ref_t *ref;
+  const char *name;
+} statics[MAX_STATICS];
+static size_t nstatics = 0;
 
-static inline void add_symbol(ref_t symbol) {
-  symbol_table = cons(symbol, symbol_table);
+static inline size_t find_slot(ref_t table, const char *name, size_t hash) {
+  size_t mask = vector_length(table) - 1, i = hash & mask;
+  ref_t sym;
+  while (!isnil(sym = vector_ref(table, i))) {
+    if (symbol_hash(sym) == hash && !strcmp(name, strvalue(sym)))
+      break;
+    i = (i + 1) & mask;
+  }
+  return i;
 }
 
-static inline bool find_symbol(const char *name, ref_t *result) {
-  ref_t symbols = symbol_table;
-  while (!isnil(symbols)) {
-    *result = car(symbols);
-    if (!strcmp(name, strvalue(*result)))
-      return YES;
-    symbols = cdr(symbols);
+static void grow_table() {
+  ref_t old = symbol_table;
+  size_t i, size = vector_length(old);
+  symbol_table = vector(2 * size, NIL);
+  for (i = 0; i < size; i++) {
+    ref_t sym = vector_ref(old, i);
+    if (!isnil(sym))
+      vector_set(symbol_table,
+                 find_slot(symbol_table, strvalue(sym), symbol_hash(sym)), sym);
   }
-  return NO;
 }
 
 ref_t intern(const char *name) {
-  ref_t result;
-  if (find_symbol(name, &result))
+  size_t hash = strhash(name), i = find_slot(symbol_table, name, hash);
+  ref_t result = vector_ref(symbol_table, i);
+  if (!isnil(result))
     return result;
   result = symbol(name);
-  add_symbol(result);
+  vector_set(symbol_table, i, result);
+  if (2 * ++symbol_count > vector_length(symbol_table))
+    grow_table();
   return result;
 }
+
+void intern_static(ref_t *ref, const char *name) {
+  if (nstatics == MAX_STATICS)
+    abort();
+  statics[nstatics].ref = ref, statics[nstatics].name = name;
+  nstatics++;
+  gc_root(ref);
+  *ref = intern(name);
+}
+
+void replace_symbol_table(ref_t table) {
+  size_t i;
+  symbol_table = table;
+  symbol_count = 0;
+  for (i = 0; i < vector_length(table); i++)
+    symbol_count += !isnil(vector_ref(table, i));
+  for (i = 0; i < nstatics; i++)
+    *statics[i].ref = intern(statics[i].name);
+}
+
+void init_env() {
+  gc_root(&symbol_table);
+  symbol_table = vector(INITIAL_SYMBOLS, NIL);
+}
@@ -5,7 +5,16 @@
 
 ref_t symbol_table;
 
+void init_env();
+
 /* Symbol Table */
 ref_t intern(const char *name);
 
+/* interns name into a C variable that stays the symbol of that name
+   when the symbol table is replaced */
+void intern_static(ref_t *ref, const char *name);
+
+/* for loading an image */
+void replace_symbol_table(ref_t table);
+
 #endif
@@ -1,10 +1,13 @@
 #include <assert.h>
 #include <stdlib.h>
+#include "alloc.h"
 #include "env.h"
 #include "eval.h"
+#include "frame.h"
 #include "error.h"
 #include "gc.h"
 #include "object.h"
+#include "vm.h"
 
 #include "print.h"
 #include <stdio.h>
@@ -12,8 +15,16 @@
 ref_t cont = NIL;
 ref_t expr = NIL;
 
+/**
+ * The frame expr is evaluated in. Each continuation keeps the frame
+ * it was pushed in, and that frame is put back whenever a value is
+ * passed to it, so an expression in tail position can be evaluated
+ * after its continuation has been popped.
+ */
+static ref_t env = NIL;
+
 /* symbols we use in the code below, they are interned by init_eval */
-static ref_t sym_amp, sym_args, sym_do, sym_fn, sym_if, sym_quote;
+static ref_t sym_amp, sym_do, sym_fn, sym_if, sym_quote;
 
 typedef enum {
   ACTION_DONE,
@@ -23,7 +34,7 @@ typedef enum {
 
 typedef action_t (*cont_t)();
 
-#define VALS 3
+#define VALS 4
 struct continuation {
   cont_t fn;
   bool expand;
@@ -31,17 +42,39 @@ struct continuation {
   ref_t closure;
   ref_t val[VALS];
 };
-#define C(obj) ((struct continuation *) ((obj) - CONTINUATION_POINTER_TAG))
 
+/**
+ * Nothing in the language captures a continuation, so they are kept
+ * on a stack rather than in the heap: pushing one is a bump of top,
+ * and pop_cont gives its slot straight back. A continuation is named
+ * by its index, tagged as a continuation pointer, since the stack is
+ * moved when it grows. The collector never sees one; the stack is
+ * traced as a root instead, so stores into it need no write barrier.
+ */
+static struct continuation *conts = NULL;
+static size_t top = 0, conts_size = 0;
+
+#define INDEX(obj) ((obj) >> 3)
+#define C(obj) (&conts[INDEX(obj)])
 
 static inline bool iscontinuation(ref_t obj) {
-  return LOWTAG(obj) == CONTINUATION_POINTER_TAG;
+  return LOWTAG(obj) == CONTINUATION_POINTER_TAG && INDEX(obj) < top;
 }
 
 static inline void pop_cont() {
+  assert(INDEX(cont) == top - 1);
+  top--;
   cont = C(cont)->saved_cont;
 }
 
+static inline void set_closure(ref_t obj, ref_t closure) {
+  C(obj)->closure = closure;
+}
+
+static inline void set_val(ref_t obj, int i, ref_t value) {
+  C(obj)->val[i] = value;
+}
+
 static inline void init_vals(ref_t obj) {
   int i;
   for (i = 0; i < VALS; i++)
@@ -49,33 +82,135 @@ static inline void init_vals(ref_t obj) {
 }
 
 static inline ref_t continuation(cont_t fn, ref_t saved_cont) {
-  ref_t obj = gc_alloc(sizeof(struct continuation), CONTINUATION_POINTER_TAG);
+  ref_t obj = (top << 3) | CONTINUATION_POINTER_TAG;
+  if (top == conts_size) {
+    conts_size = conts_size ? conts_size * 2 : 1024;
+    conts = safe_realloc(conts, conts_size * sizeof(struct continuation));
+  }
+  top++;
   C(obj)->fn = fn;
   C(obj)->expand = NO;
   C(obj)->saved_cont = saved_cont;
-  C(obj)->closure = isnil(saved_cont) ? NIL : C(saved_cont)->closure;
+  C(obj)->closure = env;
   init_vals(obj);
   return obj;
 }
 
-static void bind(ref_t symbol, ref_t value) {
-  assert(issymbol(symbol));
-  expr = cons(symbol, value);
-  C(cont)->closure = cons(expr, C(cont)->closure);
+/* the arguments of a call spread out for make_frame */
+static ref_t *argv = NULL;
+static size_t argv_size = 0;
+
+static ref_t frame_for(ref_t func, ref_t args) {
+  size_t n = 0;
+  for (; !isnil(args); args = cdr(args)) {
+    if (n == argv_size) {
+      argv_size = argv_size ? argv_size * 2 : 64;
+      argv = safe_realloc(argv, argv_size * sizeof(ref_t));
+    }
+    argv[n++] = car(args);
+  }
+  return make_frame(func, argv, n);
 }
 
-ref_t lookup(ref_t symbol) {
+/* builtins get no frame, just their arguments in an array */
+static ref_t call_builtin(ref_t func, ref_t args) {
+  ref_t argv[MAX_BUILTIN_ARITY + 1];
+  size_t i, arity = getarity(func);
+  for (i = 0; i < arity; i++, args = cdr(args))
+    argv[i] = car(args);
+  argv[arity] = args;
+  return getfn(func)(argv);
+}
+
+static ref_t lookup(ref_t symbol) {
   assert(issymbol(symbol));
-  ref_t binding, closure = C(cont)->closure;
-  while (!isnil(closure)) {
-    binding = car(closure);
-    if (car(binding) == symbol)
-      return cdr(binding);
-    closure = cdr(closure);
+  ref_t formals, frame = env;
+  size_t i;
+  for (; !isnil(frame); frame = vector_ref(frame, FRAME_PARENT)) {
+    formals = vector_ref(frame, FRAME_FORMALS);
+    for (i = FRAME_SLOTS; !isnil(formals); i++, formals = cdr(formals)) {
+      if (car(formals) == symbol)
+        return vector_ref(frame, i);
+    }
   }
   return get_value(symbol);
 }
 
+/**
+ * Lexical addressing: when a fn form is evaluated, its body is copied
+ * with every variable reference replaced by a varref giving either
+ * the depth and index of the frame slot that will hold it or, for a
+ * free variable, the global symbol. A call to a named function gets a
+ * site in place of the name, which caches the function. A macro call
+ * becomes a site itself, which expands the call the first time it
+ * runs and keeps the expansion, resolved in the same scope. The scope
+ * is a list of the formals of each enclosing frame, innermost first.
+ */
+static ref_t resolve(ref_t form, ref_t scope);
+
+static ref_t resolve_symbol(ref_t symbol, ref_t scope) {
+  int depth;
+  size_t index;
+  if (find_local(symbol, scope, &depth, &index))
+    return varref(depth, index, symbol);
+  return varref(GLOBAL_DEPTH, 0, symbol);
+}
+
+static ref_t resolve_list(ref_t forms, ref_t scope) {
+  ref_t head = NIL, tail = NIL, cell;
+  for (; iscons(forms); forms = cdr(forms)) {
+    cell = cons(resolve(car(forms), scope), NIL);
+    if (isnil(head))
+      head = cell;
+    else
+      set_cdr(tail, cell);
+    tail = cell;
+  }
+  return head;
+}
+
+static ref_t resolve_fn(ref_t form, ref_t scope) {
+  size_t arity;
+  bool rest;
+  ref_t formals = parse_formals(car(form), &arity, &rest), body = cdr(form);
+  ref_t tmpl = template(formals, body, arity, rest);
+  set_code(tmpl, resolve_list(body, extend_scope(formals, scope)));
+  return tmpl;
+}
+
+static ref_t resolve(ref_t form, ref_t scope) {
+  ref_t head;
+  if (issymbol(form))
+    return resolve_symbol(form, scope);
+  if (!iscons(form))
+    return form;
+  head = car(form);
+  if (head == sym_quote)
+    return form;
+  if (head == sym_fn)
+    return resolve_fn(cdr(form), scope);
+  if (!issymbol(head) || head == sym_do || head == sym_if)
+    return cons(head, resolve_list(cdr(form), scope));
+  if (has_function(head) && ismacro(get_function(head)))
+    return site(form, scope);
+  return cons(site(form, scope), resolve_list(cdr(form), scope));
+}
+
+static void resolve_function(ref_t func) {
+  ref_t frame, scope = NIL, last = NIL, cell;
+  /* rebuild the scope from the formals recorded in the closure */
+  for (frame = getclosure(func); !isnil(frame); frame = vector_ref(frame, FRAME_PARENT)) {
+    cell = cons(vector_ref(frame, FRAME_FORMALS), NIL);
+    if (isnil(scope))
+      scope = cell;
+    else
+      set_cdr(last, cell);
+    last = cell;
+  }
+  scope = extend_scope(getformals(func), scope);
+  set_code(func, resolve_list(getbody(func), scope));
+}
+
 static action_t cont_apply();
 static action_t cont_apply_arg();
 static action_t cont_apply_apply();
@@ -89,14 +224,15 @@ static action_t cont_list();
 static action_t cont_macroexpand();
 static action_t cont_macroexpand1();
 static action_t cont_quote();
+static action_t cont_site();
 static action_t cont_symbol();
 
 static inline void eval_apply(ref_t obj) {
-  C(cont)->fn = cont_apply, C(cont)->val[0] = obj;
+  C(cont)->fn = cont_apply, set_val(cont, 0, obj);
 }
 
 static inline void eval_do(ref_t obj) {
-  C(cont)->fn = cont_do, C(cont)->val[0] = obj;
+  C(cont)->fn = cont_do, set_val(cont, 0, obj);
 }
 
 static inline action_t eval_expr(ref_t obj) {
@@ -105,63 +241,76 @@ static inline action_t eval_expr(ref_t obj) {
   return ACTION_EVAL;
 }
 
+void check_arity(ref_t func, size_t count) {
+  size_t arity = getarity(func);
+  if (hasrest(func) ? count < arity : count != arity)
+    argument_error(count);
+}
+
 static action_t cont_apply() {
   ref_t func = C(cont)->val[0];
-  size_t len = length(expr), arity = getarity(func);
-  if (hasrest(func)) {
-    if (len < arity)
-      argument_error(len);
-  } else {
-    if (len != arity)
-      argument_error(len);
-  }
+  check_arity(func, length(expr));
   init_vals(cont);
-  C(cont)->fn = cont_apply_arg, C(cont)->val[0] = func,
-    C(cont)->val[1] = cdr(expr);
+  set_val(cont, 0, func);
+  if (isnil(expr)) {
+    C(cont)->fn = cont_apply_apply;
+    return ACTION_APPLY_CONT;
+  }
+  C(cont)->fn = cont_apply_arg, set_val(cont, 1, cdr(expr));
   return eval_expr(car(expr));
 }
 
+/* the arguments are collected in order, from the first cell in val[2]
+   to the last in val[3] */
 static action_t cont_apply_arg() {
-  ref_t first = car(C(cont)->val[1]), rest = cdr(C(cont)->val[1]);
-  C(cont)->val[2] = cons(expr, C(cont)->val[2]);
-  if (isnil(C(cont)->val[1])) {
-    ref_t args = C(cont)->val[2];
-    expr = NIL;
-    for(; !isnil(args); args = cdr(args))
-      expr = cons(car(args), expr);
+  ref_t forms = C(cont)->val[1], cell = cons(expr, NIL);
+  if (isnil(C(cont)->val[2]))
+    set_val(cont, 2, cell);
+  else
+    set_cdr(C(cont)->val[3], cell);
+  set_val(cont, 3, cell);
+  if (isnil(forms)) {
+    expr = C(cont)->val[2];
     C(cont)->fn = cont_apply_apply;
     return ACTION_APPLY_CONT;
   }
-  C(cont)->val[1] = rest;
-  return eval_expr(first);
+  set_val(cont, 1, cdr(forms));
+  return eval_expr(car(forms));
 }
 
 static action_t cont_apply_apply() {
-  ref_t func = C(cont)->val[0], args = expr;
-  ref_t formals = getformals(func);
-  size_t arity = getarity(func);
-  C(cont)->closure = getclosure(func);
-  for(; arity > 0; arity--, formals = cdr(formals), args = cdr(args))
-    bind(car(formals), car(args));
-  if (!isnil(formals))
-    bind(car(formals), args);
-  init_vals(cont);
+  ref_t func = C(cont)->val[0];
+  if (iscompiled(func)) {
+    expr = vm_apply(func, expr);
+    pop_cont();
+    return ACTION_APPLY_CONT;
+  }
   if (isbuiltin(func)) {
-    getfn(func)();
+    expr = call_builtin(func, expr);
     pop_cont();
+    return ACTION_APPLY_CONT;
   }
-  else
-    eval_do(getbody(func));
+  env = frame_for(func, expr);
+  set_closure(cont, env);
+  init_vals(cont);
+  if (getepoch(func) != macro_epoch())
+    resolve_function(func);
+  eval_do(getcode(func));
   return ACTION_APPLY_CONT;
 }
 
+/* the last form is in tail position, so it is evaluated straight
+   into the continuation of the do */
 static action_t cont_do() {
   ref_t body = C(cont)->val[0];
   if (isnil(body)) {
     pop_cont();
     return ACTION_APPLY_CONT;
   }
-  C(cont)->val[0] = cdr(body);
+  if (isnil(cdr(body)))
+    pop_cont();
+  else
+    set_val(cont, 0, cdr(body));
   return eval_expr(car(body));
 }
 
@@ -177,26 +326,45 @@ static action_t cont_eval() {
   return ACTION_EVAL;
 }
 
-static action_t cont_fn() {
-  ref_t formals = car(expr), body = cdr(expr);
-  size_t arity = 0;
-  bool rest = NO;
+/* returns the formals with any & removed, leaving the original list
+   alone so the same fn form can be evaluated again */
+ref_t parse_formals(ref_t formals, size_t *arity, bool *rest) {
+  ref_t list = formals;
+  *arity = 0, *rest = NO;
   if (!islist(formals))
     error("invalid function: formals must be a list");
-  for(; !isnil(formals); arity++, formals = cdr(formals)) {
-    ref_t sym = car(formals);
+  for(; !isnil(list); (*arity)++, list = cdr(list)) {
+    ref_t sym = car(list);
     if (sym == sym_amp) {
-      if (length(cdr(formals)) != 1)
+      if (length(cdr(list)) != 1)
         error("invalid function: must have exactly one symbol after &");
-      rest = YES;
-      set_car(formals, cadr(formals));
-      set_cdr(formals, NIL);
+      *rest = YES;
       break;
     }
   }
-  formals = car(expr);
+  if (*rest) {
+    ref_t head = NIL, tail = NIL, cell;
+    size_t i;
+    for (i = 0, list = formals; i <= *arity; i++, list = cdr(list)) {
+      cell = cons(i < *arity ? car(list) : cadr(list), NIL);
+      if (isnil(head))
+        head = cell;
+      else
+        set_cdr(tail, cell);
+      tail = cell;
+    }
+    return head;
+  }
+  return formals;
+}
+
+static action_t cont_fn() {
+  size_t arity;
+  bool rest;
+  ref_t formals = parse_formals(car(expr), &arity, &rest), body = cdr(expr);
   pop_cont();
-  expr = lambda(formals, body, C(cont)->closure, arity, rest);
+  expr = lambda(formals, body, env, arity, rest);
+  resolve_function(expr);
   return ACTION_APPLY_CONT;
 }
 
@@ -204,7 +372,7 @@ static action_t cont_if() {
   size_t len = length(expr);
   if (len < 2 || 3 < len)
     argument_error(len);
-  C(cont)->fn = cont_if_branches, C(cont)->val[0] = cdr(expr);
+  C(cont)->fn = cont_if_branches, set_val(cont, 0, cdr(expr));
   return eval_expr(car(expr));
 }
 
@@ -215,7 +383,20 @@ static action_t cont_if_branches() {
 }
 
 static action_t cont_list() {
-  ref_t sym = check_symbol(car(expr));
+  ref_t sym = car(expr), func;
+  if (issite(sym)) {
+    func = site_function(sym);
+    /* the function became a macro after the code was resolved */
+    if (ismacro(func)) {
+      pop_cont();
+      expr = sym;
+      return ACTION_EVAL;
+    }
+    eval_apply(func);
+    expr = cdr(expr);
+    return ACTION_APPLY_CONT;
+  }
+  check_symbol(sym);
   expr = cdr(expr);
   if (sym == sym_do)
     eval_do(expr);
@@ -236,7 +417,7 @@ static action_t cont_macroexpand() {
     pop_cont();
     return ACTION_APPLY_CONT;
   }
-  C(cont)->val[0] = expr;
+  set_val(cont, 0, expr);
   cont = continuation(cont_macroexpand1, cont);
   return ACTION_APPLY_CONT;
 }
@@ -247,7 +428,7 @@ static action_t cont_macroexpand1() {
     if (has_function(symbol)) {
       ref_t func = get_function(symbol);
       if (ismacro(func)) {
-        C(cont)->fn = cont_apply_apply, C(cont)->val[0] = func;
+        C(cont)->fn = cont_apply_apply, set_val(cont, 0, func);
         expr = cdr(expr);
         return ACTION_APPLY_CONT;
       }
@@ -266,37 +447,86 @@ static action_t cont_quote() {
   return ACTION_APPLY_CONT;
 }
 
+/* keeps the expansion of a site, resolved like the code around it */
+static action_t cont_site() {
+  ref_t site = C(cont)->val[0];
+  size_t epoch = intvalue(C(cont)->val[1]);
+  pop_cont();
+  expr = resolve(expr, site_scope(site));
+  set_site_code(site, expr, epoch);
+  C(cont)->expand = NO;
+  return ACTION_EVAL;
+}
+
 static action_t cont_symbol() {
   pop_cont();
   expr = lookup(expr);
   return ACTION_APPLY_CONT;
 }
 
-static void fn_apply() {
-  eval_apply(check_function(lookup(sym_fn)));
+/* the elements of the list are the arguments themselves, so they are
+   not evaluated again */
+static ref_t fn_apply(ref_t *args) {
+  ref_t func = check_function(args[0]), list = check_list(args[1]);
+  check_arity(func, length(list));
+  init_vals(cont);
+  C(cont)->fn = cont_apply_apply, set_val(cont, 0, func);
   cont = continuation(NULL, cont);
-  expr = check_list(lookup(sym_args));
+  return list;
+}
+
+bool isapply(ref_t func) {
+  return isbuiltin(func) && getfn(func) == fn_apply;
 }
 
-static void fn_macroexpand() {
+static ref_t fn_macroexpand(ref_t *args) {
   init_vals(cont);
   C(cont)->fn = cont_macroexpand;
   cont = continuation(NULL, cont);
-  expr = lookup(sym_args);
+  return args[0];
 }
 
-static void fn_macroexpand1() {
+static ref_t fn_macroexpand1(ref_t *args) {
   init_vals(cont);
   C(cont)->fn = cont_macroexpand1;
   cont = continuation(NULL, cont);
-  expr = lookup(sym_args);
+  return args[0];
 }
 
-void eval() {
-  cont = continuation(cont_end, NIL);
-  C(cont)->expand = YES;
+/* only a call to a macro expands into something else */
+static inline bool ismacrocall(ref_t form) {
+  ref_t head;
+  if (!iscons(form) || !issymbol(head = car(form)))
+    return NO;
+  return has_function(head) && ismacro(get_function(head));
+}
+
+static void run(action_t action) {
+  ref_t code;
+  if (action == ACTION_APPLY_CONT)
+    goto apply_cont;
  eval:
-  if (C(cont)->expand)
+  /* resolved code never needs expanding */
+  if (isvarref(expr)) {
+    if (varref_depth(expr) == GLOBAL_DEPTH)
+      expr = get_value(varref_symbol(expr));
+    else
+      expr = frame_ref(env, varref_depth(expr), varref_index(expr));
+  }
+  else if (istemplate(expr))
+    expr = instantiate(expr, env);
+  else if (issite(expr)) {
+    if ((code = site_code(expr)) != UNBOUND) {
+      expr = code;
+      C(cont)->expand = NO;
+      goto eval;
+    }
+    cont = continuation(cont_site, cont);
+    set_val(cont, 0, expr), set_val(cont, 1, integer(macro_epoch()));
+    expr = site_form(expr);
+    cont = continuation(cont_macroexpand, cont);
+  }
+  else if (C(cont)->expand && ismacrocall(expr))
     cont = continuation(cont_macroexpand, continuation(cont_eval, cont));
   else if (iscons(expr))
     cont = continuation(cont_list, cont);
@@ -305,6 +535,8 @@ void eval() {
 
  apply_cont:
   assert(iscontinuation(cont));
+  env = C(cont)->closure;
+  gc_safepoint();
   switch(C(cont)->fn()) {
   case ACTION_EVAL:
     goto eval;
@@ -320,14 +552,64 @@ void eval() {
   assert(isnil(cont));
 }
 
+void eval() {
+  reset_eval();
+  cont = continuation(cont_end, NIL);
+  C(cont)->expand = YES;
+  run(ACTION_EVAL);
+}
+
+void reset_eval() {
+  top = 0;
+  env = NIL;
+}
+
+bool iscontrol(ref_t func) {
+  fn_t fn = getfn(func);
+  return fn == fn_apply || fn == fn_macroexpand || fn == fn_macroexpand1;
+}
+
+/* the nested evaluation runs on top of the interrupted one, with
+   its own cont_end holding the interrupted expr and env */
+ref_t apply_function(ref_t func, ref_t args) {
+  ref_t result, outer_cont = cont, outer_expr = expr, end;
+  size_t base = top;
+  check_arity(func, length(args));
+  /* builtins that do not touch the continuation can just be called */
+  if (isbuiltin(func) && !iscontrol(func))
+    return call_builtin(func, args);
+  end = continuation(cont_end, NIL);
+  set_val(end, 0, outer_expr);
+  cont = continuation(cont_apply_apply, end);
+  set_val(cont, 0, func);
+  expr = args;
+  run(ACTION_APPLY_CONT);
+  result = expr;
+  expr = C(end)->val[0], env = C(end)->closure;
+  top = base, cont = outer_cont;
+  return result;
+}
+
+static void trace_conts(gc_visit_t visit) {
+  size_t i;
+  int j;
+  for (i = 0; i < top; i++) {
+    visit(&conts[i].closure);
+    for (j = 0; j < VALS; j++)
+      visit(&conts[i].val[j]);
+  }
+}
+
 void init_eval() {
-  sym_amp = intern("&");
-  sym_args = intern("args");
-  sym_do = intern("do");
-  sym_fn = intern("fn");
-  sym_if = intern("if");
-  sym_quote = intern("quote");
-  set_function(intern("apply"), builtin(cons(sym_fn, cons(sym_args, NIL)), fn_apply, 2, NO));
-  set_function(intern("macroexpand"), builtin(cons(sym_args, NIL), fn_macroexpand, 1, NO));
-  set_function(intern("macroexpand1"), builtin(cons(sym_args, NIL), fn_macroexpand1, 1, NO));
+  gc_tracer(trace_conts);
+  gc_root(&expr);
+  gc_root(&env);
+  intern_static(&sym_amp, "&");
+  intern_static(&sym_do, "do");
+  intern_static(&sym_fn, "fn");
+  intern_static(&sym_if, "if");
+  intern_static(&sym_quote, "quote");
+  set_function(intern("apply"), builtin(fn_apply, 2, NO));
+  set_function(intern("macroexpand"), builtin(fn_macroexpand, 1, NO));
+  set_function(intern("macroexpand1"), builtin(fn_macroexpand1, 1, NO));
 }
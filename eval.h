@@ -1,6 +1,7 @@
 #ifndef EVAL_H
 #define EVAL_H
 
+#include "gc.h"
 #include "types.h"
 
 /* the current continuation */
@@ -11,6 +12,17 @@ ref_t expr;
 
 void init_eval();
 void eval();
+void reset_eval();
+
+/* runs func to completion from C, wherever we are in an evaluation */
+ref_t apply_function(ref_t func, ref_t args);
+
+void check_arity(ref_t func, size_t count);
+bool isapply(ref_t func);
+
+/* whether func is a builtin that takes over the continuation, which
+   only the evaluator can run */
+bool iscontrol(ref_t func);
+ref_t parse_formals(ref_t formals, size_t *arity, bool *rest);
 
-ref_t lookup(ref_t symbol);
 #endif
@@ -0,0 +1,43 @@
+#include "frame.h"
+#include "object.h"
+
+ref_t make_frame(ref_t func, const ref_t *args, size_t n) {
+  size_t i, arity = getarity(func);
+  ref_t frame, rest = NIL;
+  if (isnil(getformals(func)))
+    return getclosure(func);
+  frame = vector(FRAME_SLOTS + arity + hasrest(func), NIL);
+  vector_set(frame, FRAME_PARENT, getclosure(func));
+  vector_set(frame, FRAME_FORMALS, getformals(func));
+  for (i = 0; i < arity; i++)
+    vector_set(frame, FRAME_SLOTS + i, args[i]);
+  if (hasrest(func)) {
+    for (i = n; i > arity; i--)
+      rest = cons(args[i - 1], rest);
+    vector_set(frame, FRAME_SLOTS + arity, rest);
+  }
+  return frame;
+}
+
+ref_t frame_ref(ref_t frame, int depth, size_t index) {
+  for (; depth > 0; depth--)
+    frame = vector_ref(frame, FRAME_PARENT);
+  return vector_ref(frame, FRAME_SLOTS + index);
+}
+
+/* functions without formals do not get a frame, so they add no scope */
+ref_t extend_scope(ref_t formals, ref_t scope) {
+  return isnil(formals) ? scope : cons(formals, scope);
+}
+
+bool find_local(ref_t symbol, ref_t scope, int *depth, size_t *index) {
+  ref_t formals;
+  for (*depth = 0; !isnil(scope); ++*depth, scope = cdr(scope)) {
+    formals = car(scope);
+    for (*index = 0; !isnil(formals); ++*index, formals = cdr(formals)) {
+      if (car(formals) == symbol)
+        return YES;
+    }
+  }
+  return NO;
+}
@@ -0,0 +1,32 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include "types.h"
+
+/**
+ * A closure is a chain of frames, each a vector holding its parent
+ * frame, the formals it binds and then one slot per formal, filled in
+ * when a function is applied. NIL is the global environment. Both
+ * evaluators build frames and resolve names against them through
+ * these, so they always agree on the layout.
+ */
+#define FRAME_PARENT 0
+#define FRAME_FORMALS 1
+#define FRAME_SLOTS 2
+
+/* the frame for a call to func with n arguments, those past its arity
+   going into its rest; a function without formals gets no frame and
+   runs in its closure */
+ref_t make_frame(ref_t func, const ref_t *args, size_t n);
+ref_t frame_ref(ref_t frame, int depth, size_t index);
+
+/**
+ * A scope is the formals of each frame that will enclose some code,
+ * innermost first, for finding where a variable will be at run time.
+ */
+ref_t extend_scope(ref_t formals, ref_t scope);
+/* whether symbol is bound in scope, and if so how many frames out and
+   in which slot */
+bool find_local(ref_t symbol, ref_t scope, int *depth, size_t *index);
+
+#endif
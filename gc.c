@@ -1,8 +1,313 @@
+#include <stdlib.h>
+#include <string.h>
 #include "alloc.h"
 #include "gc.h"
+#include "object.h"
 
 #define ALIGNED_SIZE(size) (((size) + LOWTAG_MASK) & ~LOWTAG_MASK)
 
+/* every object must have room for a forwarding pointer */
+#define MIN_OBJECT_SIZE (2 * sizeof(ref_t))
+#define OBJECT_SIZE(size) \
+  (ALIGNED_SIZE(size) < MIN_OBJECT_SIZE ? MIN_OBJECT_SIZE : ALIGNED_SIZE(size))
+
+/* the nursery is carved out of chunks of this size; we ask for a
+   collection once NURSERY_CHUNKS of them have filled up, but keep
+   adding chunks until the evaluator reaches a safepoint */
+#define CHUNK_SIZE (1024 * 1024)
+#define NURSERY_CHUNKS 4
+
+/* objects too big for a chunk go straight into the old space */
+#define LARGE_OBJECT (CHUNK_SIZE / 4)
+
+/* do a major collection once this many bytes have been promoted
+   since the last one, or the live old space size if that is larger */
+#define MIN_THRESHOLD (4 * 1024 * 1024)
+
+#define MAX_ROOTS 64
+#define MAX_TRACERS 8
+
+/* stored in the first word of a nursery object that has been copied
+   out, the second word then holds its new address. It is an
+   immediate no object can start with: no ref has this value, and it
+   is well above any object tag. */
+#define FORWARDED 0xF2
+
+/**
+ * The nursery is a bump-pointer arena: new objects are handed out
+ * from the current chunk with no per-object overhead. Objects that
+ * survive a collection are copied into the old space, where each one
+ * is preceded by a header that links it into the list of all old
+ * objects so that the sweep phase can find the dead ones.
+ *
+ * A minor collection only traces the young objects reachable from
+ * the roots and from the remembered set: the old objects that the
+ * write barrier has seen being pointed at young ones. A major
+ * collection marks the whole heap and sweeps the old space.
+ */
+struct chunk {
+  char *free, *limit;
+  char start[];
+};
+
+struct header {
+  struct header *next;
+  size_t size;
+  bool marked, remembered;
+};
+#define HEADER(ref) (((struct header *) ((ref) & ~LOWTAG_MASK)) - 1)
+
+static struct chunk **nursery = NULL;
+static size_t current = 0, nchunks = 0, nursery_size = 0;
+static char *nursery_lo = NULL, *nursery_hi = NULL;
+
+static struct header *objects = NULL;
+
+/* old objects loaded from an image, which are never freed */
+static struct header *permanent = NULL;
+static size_t allocated = 0, live = 0, threshold = MIN_THRESHOLD;
+static bool major = NO;
+
+static ref_t *remembered = NULL;
+static size_t nremembered = 0, remembered_size = 0;
+
+static ref_t *roots[MAX_ROOTS];
+static size_t nroots = 0;
+
+static void (*tracers[MAX_TRACERS])(gc_visit_t visit);
+static size_t ntracers = 0;
+
+/* tracing uses an explicit stack, since lists can be far deeper
+   than the C stack */
+static ref_t *mark_stack = NULL;
+static size_t mark_top = 0, mark_size = 0;
+
+static struct chunk *alloc_chunk() {
+  struct chunk *chunk = safe_malloc(sizeof(struct chunk) + CHUNK_SIZE);
+  chunk->free = chunk->start;
+  chunk->limit = chunk->start + CHUNK_SIZE;
+  if (!nursery_lo || chunk->start < nursery_lo)
+    nursery_lo = chunk->start;
+  if (chunk->limit > nursery_hi)
+    nursery_hi = chunk->limit;
+  return chunk;
+}
+
+static struct chunk *next_chunk() {
+  if (current + 1 < nchunks)
+    return nursery[++current];
+  if (nchunks == nursery_size) {
+    nursery_size = nursery_size ? nursery_size * 2 : NURSERY_CHUNKS;
+    nursery = safe_realloc(nursery, nursery_size * sizeof(struct chunk *));
+  }
+  current = nchunks;
+  return nursery[nchunks++] = alloc_chunk();
+}
+
+static bool isyoung(ref_t obj) {
+  char *ptr = (char *) (obj & ~LOWTAG_MASK);
+  size_t i;
+  if (ptr < nursery_lo || nursery_hi <= ptr)
+    return NO;
+  /* newest first, since what is checked most is what was just made */
+  for (i = current + 1; i-- > 0;) {
+    if (nursery[i]->start <= ptr && ptr < nursery[i]->limit)
+      return YES;
+  }
+  return NO;
+}
+
+static ref_t alloc_old(size_t size, uint8_t lowtag) {
+  struct header *header = safe_malloc(sizeof(struct header) + size);
+  header->next = objects, header->size = size;
+  header->marked = header->remembered = NO;
+  objects = header;
+  allocated += size;
+  return ((ref_t) (header + 1)) + lowtag;
+}
+
+static void remember(ref_t obj) {
+  if (HEADER(obj)->remembered)
+    return;
+  HEADER(obj)->remembered = YES;
+  if (nremembered == remembered_size) {
+    remembered_size = remembered_size ? remembered_size * 2 : 1024;
+    remembered = safe_realloc(remembered, remembered_size * sizeof(ref_t));
+  }
+  remembered[nremembered++] = obj;
+}
+
 ref_t gc_alloc(size_t bytes, uint8_t lowtag) {
-  return ((ref_t) safe_malloc(ALIGNED_SIZE(bytes))) + lowtag;
+  size_t size = OBJECT_SIZE(bytes);
+  struct chunk *chunk = nchunks ? nursery[current] : next_chunk();
+  if (size > LARGE_OBJECT) {
+    /* it is about to be filled in without the write barrier */
+    ref_t obj = alloc_old(size, lowtag);
+    remember(obj);
+    return obj;
+  }
+  if (chunk->free + size > chunk->limit)
+    chunk = next_chunk();
+  chunk->free += size;
+  return ((ref_t) (chunk->free - size)) + lowtag;
+}
+
+void gc_root(ref_t *ref) {
+  if (nroots == MAX_ROOTS)
+    abort();
+  roots[nroots++] = ref;
+}
+
+void gc_tracer(void (*tracer)(gc_visit_t visit)) {
+  if (ntracers == MAX_TRACERS)
+    abort();
+  tracers[ntracers++] = tracer;
+}
+
+void gc_write_barrier(ref_t obj, ref_t value) {
+  if (ispointer(value) && !isyoung(obj) && isyoung(value))
+    remember(obj);
+}
+
+static void push(ref_t obj) {
+  if (mark_top == mark_size) {
+    mark_size = mark_size ? mark_size * 2 : 1024;
+    mark_stack = safe_realloc(mark_stack, mark_size * sizeof(ref_t));
+  }
+  mark_stack[mark_top++] = obj;
+}
+
+static size_t size_of(ref_t obj) {
+  return OBJECT_SIZE(object_size(obj));
+}
+
+static ref_t promote(ref_t obj) {
+  ref_t *words = (ref_t *) (obj & ~LOWTAG_MASK);
+  size_t size = size_of(obj);
+  ref_t copy = alloc_old(size, LOWTAG(obj));
+  memcpy(HEADER(copy) + 1, words, size);
+  HEADER(copy)->marked = major;
+  words[0] = FORWARDED, words[1] = copy;
+  push(copy);
+  return copy;
+}
+
+static ref_t forward(ref_t obj) {
+  ref_t *words = (ref_t *) (obj & ~LOWTAG_MASK);
+  return words[0] == FORWARDED ? words[1] : promote(obj);
+}
+
+static void visit_young(ref_t *ref) {
+  if (ispointer(*ref) && isyoung(*ref))
+    *ref = forward(*ref);
+}
+
+static void visit(ref_t *ref) {
+  ref_t obj = *ref;
+  if (!ispointer(obj))
+    return;
+  if (isyoung(obj))
+    *ref = forward(obj);
+  else if (!HEADER(obj)->marked) {
+    HEADER(obj)->marked = YES;
+    push(obj);
+  }
+}
+
+static void forget_remembered() {
+  size_t i;
+  for (i = 0; i < nremembered; i++)
+    HEADER(remembered[i])->remembered = NO;
+  nremembered = 0;
+}
+
+static void sweep() {
+  struct header **link = &objects, *header;
+  for (header = permanent; header; header = header->next)
+    header->marked = NO;
+  live = 0;
+  while ((header = *link)) {
+    if (header->marked) {
+      header->marked = NO;
+      live += header->size;
+      link = &header->next;
+    } else {
+      *link = header->next;
+      free(header);
+    }
+  }
+}
+
+/* keep the first NURSERY_CHUNKS chunks around for reuse, and give
+   back any the nursery overflowed into */
+static void reset_nursery() {
+  size_t i;
+  for (i = NURSERY_CHUNKS; i < nchunks; i++)
+    free(nursery[i]);
+  if (nchunks > NURSERY_CHUNKS)
+    nchunks = NURSERY_CHUNKS;
+  nursery_lo = nursery_hi = NULL;
+  for (i = 0; i < nchunks; i++) {
+    nursery[i]->free = nursery[i]->start;
+    if (!nursery_lo || nursery[i]->start < nursery_lo)
+      nursery_lo = nursery[i]->start;
+    if (nursery[i]->limit > nursery_hi)
+      nursery_hi = nursery[i]->limit;
+  }
+  current = 0;
+}
+
+static void minor_collection() {
+  size_t i;
+  for (i = 0; i < nroots; i++)
+    visit_young(roots[i]);
+  for (i = 0; i < ntracers; i++)
+    tracers[i](visit_young);
+  for (i = 0; i < nremembered; i++)
+    trace_object(remembered[i], visit_young);
+  while (mark_top > 0)
+    trace_object(mark_stack[--mark_top], visit_young);
+  forget_remembered();
+  reset_nursery();
+}
+
+void gc_collect() {
+  size_t i;
+  major = YES;
+  for (i = 0; i < nroots; i++)
+    visit(roots[i]);
+  for (i = 0; i < ntracers; i++)
+    tracers[i](visit);
+  while (mark_top > 0)
+    trace_object(mark_stack[--mark_top], visit);
+  major = NO;
+  /* everything young has been promoted, so nothing needs remembering */
+  forget_remembered();
+  sweep();
+  reset_nursery();
+  allocated = 0;
+  threshold = live > MIN_THRESHOLD ? live : MIN_THRESHOLD;
+}
+
+size_t gc_header_size() {
+  return sizeof(struct header);
+}
+
+size_t gc_object_size(ref_t obj) {
+  return size_of(obj);
+}
+
+void gc_adopt(ref_t obj) {
+  struct header *header = HEADER(obj);
+  header->size = size_of(obj);
+  header->marked = header->remembered = NO;
+  header->next = permanent;
+  permanent = header;
+}
+
+void gc_safepoint() {
+  if (allocated >= threshold)
+    gc_collect();
+  else if (current >= NURSERY_CHUNKS)
+    minor_collection();
 }
@@ -10,10 +10,10 @@
  * represent by eight.
  *
  * Lowtags:
- * x00 - Fixnum (this eats up two tags, but that gives us 2^30 fixnums)
+ * x00 - Fixnum (this eats up two tags, but leaves 62 bits on LP64)
  * x10 - Other Immediate (e.g. nil, true)
  * xx1 - Pointer
- * 001 -   Continuation Pointer
+ * 001 -   Continuation Pointer (an index into the evaluator's stack)
  * 011 -   List Pointer
  * 101 -   Function Pointer
  * 111 -   Other Pointer
@@ -27,6 +27,41 @@
 
 #define LOWTAG(ref) ((ref) & LOWTAG_MASK)
 
+/* Called by the tracing functions for each reference an object holds */
+typedef void (*gc_visit_t)(ref_t *ref);
+
 ref_t gc_alloc(size_t bytes, uint8_t lowtag);
 
+/* Registers the address of a reference that must survive collection */
+void gc_root(ref_t *ref);
+
+/* Registers a function that visits references held outside the heap */
+void gc_tracer(void (*tracer)(gc_visit_t visit));
+
+/**
+ * Must be called after storing value into a field of obj once obj
+ * has been initialized, so that old objects pointing at young ones
+ * are found by minor collections.
+ */
+void gc_write_barrier(ref_t obj, ref_t value);
+
+/**
+ * Collection only happens at a safepoint, where every live object is
+ * reachable from the registered roots. The evaluator calls this
+ * between steps; everywhere else allocation simply proceeds.
+ */
+void gc_safepoint();
+void gc_collect();
+
+/**
+ * Heap images lay objects out as the old space does, each after
+ * gc_header_size() bytes for its header and padded to
+ * gc_object_size(), so that a loaded image is used where it lies.
+ * Each loaded object is handed to gc_adopt, which makes it an old
+ * object that is never freed.
+ */
+size_t gc_header_size();
+size_t gc_object_size(ref_t obj);
+void gc_adopt(ref_t obj);
+
 #endif
@@ -0,0 +1,229 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "builtins.h"
+#include "env.h"
+#include "error.h"
+#include "gc.h"
+#include "image.h"
+#include "object.h"
+
+/**
+ * An image is a header followed by the objects, each laid out as the
+ * old space lays it out. Until an object is adopted, the first word of
+ * the room left for its collector header holds its padded size and
+ * lowtag. References to other objects hold their offset from the
+ * start of the objects, tagged as before, and builtins hold their
+ * offset from load_image. The header records the format version and
+ * the object layout, and an image that disagrees with either is
+ * refused rather than misread.
+ */
+#define MAGIC "OBJIMG1"
+#define VERSION 2
+
+struct image_header {
+  char magic[8];
+  uint64_t version;
+  uint32_t layout[LAYOUT_SIZE];
+  uint64_t build;
+  uint64_t size;
+  uint64_t root;
+  uint64_t macro_epoch, function_epoch;
+};
+
+#define CODE_OFFSET(fn) ((intptr_t) (fn) - (intptr_t) load_image)
+
+/* differs between builds that lay out their code differently */
+#define BUILD ((uint64_t) CODE_OFFSET(init_builtins))
+
+/**
+ ** Saving
+ **/
+
+/* the objects to save, in the order they are written */
+static ref_t *objects = NULL;
+static size_t nobjects = 0, objects_size = 0;
+
+/* where each of them goes, hashed by address */
+struct entry {
+  ref_t obj;
+  uint64_t offset;
+};
+static struct entry *entries = NULL;
+static size_t entries_size = 0;
+
+static uint64_t image_size = 0;
+
+static size_t find_entry(ref_t obj) {
+  size_t mask = entries_size - 1, i = ((obj >> 3) * 2654435761u) & mask;
+  while (entries[i].obj && entries[i].obj != obj)
+    i = (i + 1) & mask;
+  return i;
+}
+
+static void grow_entries() {
+  struct entry *old = entries;
+  size_t i, size = entries_size;
+  entries_size = size ? size * 2 : 1024;
+  entries = safe_malloc(entries_size * sizeof(struct entry));
+  memset(entries, 0, entries_size * sizeof(struct entry));
+  for (i = 0; i < size; i++) {
+    if (old[i].obj)
+      entries[find_entry(old[i].obj)] = old[i];
+  }
+  free(old);
+}
+
+/* gives an object its place in the image the first time it is seen */
+static void discover(ref_t *ref) {
+  ref_t obj = *ref;
+  size_t i;
+  if (!ispointer(obj))
+    return;
+  if (LOWTAG(obj) == CONTINUATION_POINTER_TAG)
+    error("cannot save a continuation");
+  i = find_entry(obj);
+  if (entries[i].obj)
+    return;
+  entries[i].obj = obj;
+  entries[i].offset = image_size + gc_header_size();
+  image_size += gc_header_size() + gc_object_size(obj);
+  if (nobjects == objects_size) {
+    objects_size = objects_size ? objects_size * 2 : 1024;
+    objects = safe_realloc(objects, objects_size * sizeof(ref_t));
+  }
+  objects[nobjects++] = obj;
+  if (2 * nobjects > entries_size)
+    grow_entries();
+}
+
+static void to_offset(ref_t *ref) {
+  if (ispointer(*ref))
+    *ref = entries[find_entry(*ref)].offset + LOWTAG(*ref);
+}
+
+static void forget_objects() {
+  free(objects), free(entries);
+  objects = NULL, entries = NULL;
+  nobjects = objects_size = entries_size = 0;
+  image_size = 0;
+}
+
+void save_image(const char *filename) {
+  struct image_header header;
+  ref_t root = symbol_table, obj, copy;
+  char *area;
+  uint64_t offset;
+  size_t i, written, macro_epoch, function_epoch;
+  FILE *out;
+  grow_entries();
+  discover(&root);
+  for (i = 0; i < nobjects; i++)
+    trace_object(objects[i], discover);
+
+  area = safe_malloc(image_size);
+  memset(area, 0, image_size);
+  for (i = 0; i < nobjects; i++) {
+    obj = objects[i];
+    offset = entries[find_entry(obj)].offset;
+    *(uint64_t *) (area + offset - gc_header_size()) = gc_object_size(obj) | LOWTAG(obj);
+    memcpy(area + offset, (void *) (obj & ~LOWTAG_MASK), object_size(obj));
+    copy = (ref_t) (area + offset) + LOWTAG(obj);
+    trace_object(copy, to_offset);
+    if (isfunction(copy) && isbuiltin(copy))
+      setfn(copy, (fn_t) CODE_OFFSET(getfn(copy)));
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  object_layout(header.layout);
+  header.build = BUILD;
+  header.size = image_size;
+  to_offset(&root);
+  header.root = root;
+  get_epochs(&macro_epoch, &function_epoch);
+  header.macro_epoch = macro_epoch, header.function_epoch = function_epoch;
+  forget_objects();
+
+  if (!(out = fopen(filename, "wb"))) {
+    free(area);
+    error("cannot open %s", filename);
+  }
+  written = fwrite(&header, sizeof(header), 1, out) + fwrite(area, header.size, 1, out);
+  free(area);
+  if (fclose(out) || written != 2)
+    error("cannot write %s", filename);
+}
+
+/**
+ ** Loading
+ **/
+
+static ref_t base;
+
+static void relocate(ref_t *ref) {
+  if (ispointer(*ref))
+    *ref += base;
+}
+
+void load_image(const char *filename) {
+  struct image_header *header;
+  uint32_t layout[LAYOUT_SIZE];
+  uint64_t version;
+  struct stat st;
+  size_t length = 0;
+  char *map, *p, *end;
+  ref_t desc, obj;
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    error("cannot open %s", filename);
+  if (fstat(fd, &st) || (length = st.st_size) < sizeof(struct image_header)) {
+    close(fd);
+    error("not an image: %s", filename);
+  }
+  /* the objects are written to in place, but never back to the file */
+  map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    error("cannot map %s", filename);
+  header = (struct image_header *) map;
+  if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) ||
+      header->size != length - sizeof(struct image_header)) {
+    munmap(map, length);
+    error("not an image: %s", filename);
+  }
+  if ((version = header->version) != VERSION) {
+    munmap(map, length);
+    error("%s is an image of version %lu, not %d", filename, (unsigned long) version, VERSION);
+  }
+  object_layout(layout);
+  if (memcmp(header->layout, layout, sizeof(layout))) {
+    munmap(map, length);
+    error("%s was saved with a different object layout", filename);
+  }
+  if (header->build != BUILD) {
+    munmap(map, length);
+    error("%s was saved by a different build", filename);
+  }
+
+  p = map + sizeof(struct image_header);
+  end = p + header->size;
+  base = (ref_t) p;
+  while (p < end) {
+    desc = *(ref_t *) p;
+    obj = (ref_t) (p + gc_header_size()) + LOWTAG(desc);
+    trace_object(obj, relocate);
+    if (isfunction(obj) && isbuiltin(obj))
+      setfn(obj, (fn_t) ((intptr_t) load_image + (intptr_t) getfn(obj)));
+    gc_adopt(obj);
+    p += gc_header_size() + (desc & ~LOWTAG_MASK);
+  }
+  skip_epochs(header->macro_epoch, header->function_epoch);
+  replace_symbol_table(header->root + base);
+}
@@ -0,0 +1,15 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+/**
+ * Heap images: everything reachable from the symbol table, written
+ * so that loading maps the file and relocates it in one pass. An
+ * image holds the addresses of builtins, so it can only be loaded by
+ * the build that saved it. Both raise an error on failure.
+ */
+void save_image(const char *filename);
+
+/* replaces the symbol table with the image's */
+void load_image(const char *filename);
+
+#endif
@@ -4,23 +4,35 @@
 #include <getopt.h>
 #include "env.h"
 #include "eval.h"
+#include "gc.h"
 #include "error.h"
+#include "image.h"
 #include "builtins.h"
+#include "compile.h"
 #include "object.h"
 #include "read.h"
 #include "print.h"
+#include "vm.h"
+
+/* the tree-walking evaluator, or the bytecode VM with -b */
+static void (*evaluate)() = eval;
+
+/* where -s saves the heap once the input has run */
+static const char *image_file = NULL;
 
 static void usage() {
-  /* TODO */
+  fputs("usage: object [-b] [-i image] [-d file [-s image]]\n", stderr);
   exit(1);
 }
 
 static void repl() {
+  reader *input = openreader("-");
   for (;;) {
     printf("> ");
+    fflush(stdout);
     if (setjmp(error_loc) == 0) {
-      expr = readsexp(stdin);
-      eval();
+      expr = readsexp(input);
+      evaluate();
       print(expr);
     }
     else
@@ -28,11 +40,23 @@ static void repl() {
     puts("");
   }
 }
+/* each form is read once the one before it has run, so the value of
+   the last is printed without the whole program ever being in memory */
 static void do_it(const char *filename) {
-  FILE *input = !strcmp("-", filename) ? stdin : fopen(filename, "r");
+  reader *input;
+  ref_t form;
   if (setjmp(error_loc) == 0) {
-    expr = cons(intern("do"), readstream(input));
-    eval();
+    if (!(input = openreader(filename)))
+      error("cannot open %s", filename);
+    expr = NIL;
+    while ((form = readform(input)) != UNBOUND) {
+      expr = form;
+      evaluate();
+      gc_safepoint();
+    }
+    closereader(input);
+    if (image_file)
+      save_image(image_file);
     print(expr);
     puts("");
   } else {
@@ -44,24 +68,52 @@ static void do_it(const char *filename) {
 int main(int argc, char **argv) {
   int ch;
   bool do_mode = NO;
-  const char *input_file;
+  const char *input_file, *load_file = NULL;
 
   static struct option longopts[] = {
-    {"do", optional_argument, NULL, 'd'}
+    {"bytecode", no_argument, NULL, 'b'},
+    {"do", optional_argument, NULL, 'd'},
+    {"image", required_argument, NULL, 'i'},
+    {"save-image", required_argument, NULL, 's'},
+    {NULL, 0, NULL, 0}
   };
-  while ((ch = getopt_long(argc, argv, "cd:-", longopts, NULL)) != -1) {
+  while ((ch = getopt_long(argc, argv, "bcd:i:s:-", longopts, NULL)) != -1) {
     switch(ch) {
+    case 'b':
+      evaluate = vm_eval;
+      break;
     case 'd':
       do_mode = YES;
       input_file = optarg;
       break;
+    case 'i':
+      load_file = optarg;
+      break;
+    case 's':
+      image_file = optarg;
+      break;
     default:
       usage();
     }
   }
+  /* the REPL only ends by exiting, so there is no point to save at */
+  if (image_file && !do_mode)
+    usage();
 
+  init_env();
   init_builtins();
   init_eval();
+  init_compile();
+  init_vm();
+
+  if (load_file) {
+    if (setjmp(error_loc) == 0)
+      load_image(load_file);
+    else {
+      fprintf(stderr, "ERROR: %s", the_error);
+      exit(1);
+    }
+  }
 
   if (do_mode)
     do_it(input_file);
@@ -1,7 +1,12 @@
 #include <assert.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "alloc.h"
+#include "bignum.h"
 #include "error.h"
 #include "gc.h"
 #include "object.h"
@@ -12,6 +17,14 @@
  * 000000100 - 0x04 - function
  * 000000101 - 0x05 - macro
  * 000000110 - 0x06 - special form
+ * 000000111 - 0x07 - vector
+ * 000001000 - 0x08 - variable reference
+ * 000001001 - 0x09 - function template
+ * 000001010 - 0x0A - bytecode
+ * 000001011 - 0x0B - call site
+ * 000001100 - 0x0C - bignum
+ * 000001101 - 0x0D - flonum
+ * 000001110 - 0x0E - string builder
  */
 
 #define STRING_TAG 1
@@ -19,6 +32,22 @@
 #define FUNCTION_TAG 4
 #define MACRO_TAG 5
 #define SPECIAL_FORM_TAG 6
+#define VECTOR_TAG 7
+#define VARREF_TAG 8
+#define TEMPLATE_TAG 9
+#define BYTECODE_TAG 10
+#define SITE_TAG 11
+#define BIGNUM_TAG 12
+#define FLONUM_TAG 13
+#define BUILDER_TAG 14
+
+/* bumped whenever a symbol's function could change to or from being a
+   macro, which invalidates the resolved code of every function */
+static size_t epoch = 0;
+
+/* bumped whenever any symbol's function changes, which invalidates
+   the function every call site has cached */
+static size_t function_epoch = 0;
 
 /**
  ** Types
@@ -35,13 +64,17 @@ struct function {
   ref_t formals;
   ref_t body;
   ref_t closure;
+  ref_t code;
+  size_t epoch;
   size_t arity;
   bool rest;
 };
 #define FN(obj) ((struct function *) ((obj) - FUNCTION_POINTER_TAG))
 
+/* the bytes are terminated as well, but may hold NULs of their own */
 struct string {
   uint8_t tag;
+  size_t length;
   /* must be last */
   char bytes[1];
 };
@@ -49,6 +82,7 @@ struct string {
 
 struct symbol {
   uint8_t tag;
+  size_t hash;
   ref_t value;
   ref_t fvalue;
   /* must be last */
@@ -56,11 +90,100 @@ struct symbol {
 };
 #define SYMBOL(obj) ((struct symbol *) ((obj) - OTHER_POINTER_TAG))
 
+struct vector {
+  uint8_t tag;
+  size_t length;
+  /* must be last */
+  ref_t items[1];
+};
+#define VECTOR(obj) ((struct vector *) ((obj) - OTHER_POINTER_TAG))
+#define VECTOR_SIZE(length) (offsetof(struct vector, items) + (length) * sizeof(ref_t))
+
+struct varref {
+  uint8_t tag;
+  int depth;
+  size_t index;
+  ref_t symbol;
+};
+#define VARREF(obj) ((struct varref *) ((obj) - OTHER_POINTER_TAG))
+
+struct bytecode {
+  uint8_t tag;
+  ref_t consts;
+  size_t length;
+  /* must be last */
+  int ops[1];
+};
+#define BYTECODE(obj) ((struct bytecode *) ((obj) - OTHER_POINTER_TAG))
+#define BYTECODE_SIZE(length) (offsetof(struct bytecode, ops) + (length) * sizeof(int))
+
+struct site {
+  uint8_t tag;
+  ref_t form;
+  ref_t scope;
+  ref_t code;
+  size_t epoch;
+  ref_t fn;
+  size_t fn_epoch;
+};
+#define SITE(obj) ((struct site *) ((obj) - OTHER_POINTER_TAG))
+
+/* only integers that do not fit in a fixnum are bignums */
+struct bignum {
+  uint8_t tag;
+  bool negative;
+  size_t length;
+  /* must be last */
+  limb_t limbs[1];
+};
+#define BIGNUM(obj) ((struct bignum *) ((obj) - OTHER_POINTER_TAG))
+#define BIGNUM_SIZE(length) (offsetof(struct bignum, limbs) + (length) * sizeof(limb_t))
+
+struct flonum {
+  uint8_t tag;
+  double value;
+};
+#define FLONUM(obj) ((struct flonum *) ((obj) - OTHER_POINTER_TAG))
+
+/**
+ * A string builder keeps what has been appended as a list of strings,
+ * newest first. Short appends are copied into a tail chunk, which is
+ * pushed once it is full; long ones are pushed as they are. The first
+ * time the whole is needed it is flattened into one string, which
+ * becomes the only chunk.
+ */
+struct builder {
+  uint8_t tag;
+  size_t length;
+  ref_t chunks;
+  ref_t tail;
+  size_t fill;
+};
+#define BUILDER(obj) ((struct builder *) ((obj) - OTHER_POINTER_TAG))
+
 
 /**
  ** Type Predicates
  **/
 
+bool isbignum(ref_t obj) {
+  if (LOWTAG(obj) != OTHER_POINTER_TAG)
+    return NO;
+  return BIGNUM(obj)->tag == BIGNUM_TAG;
+}
+
+bool isbuilder(ref_t obj) {
+  if (LOWTAG(obj) != OTHER_POINTER_TAG)
+    return NO;
+  return BUILDER(obj)->tag == BUILDER_TAG;
+}
+
+bool isbytecode(ref_t obj) {
+  if (LOWTAG(obj) != OTHER_POINTER_TAG)
+    return NO;
+  return BYTECODE(obj)->tag == BYTECODE_TAG;
+}
+
 bool iscons(ref_t obj) {
   return LOWTAG(obj) == LIST_POINTER_TAG;
 }
@@ -69,12 +192,18 @@ bool isfixnum(ref_t obj) {
   return !(obj & 3);
 }
 
+bool isflonum(ref_t obj) {
+  if (LOWTAG(obj) != OTHER_POINTER_TAG)
+    return NO;
+  return FLONUM(obj)->tag == FLONUM_TAG;
+}
+
 bool isfunction(ref_t obj) {
   return LOWTAG(obj) == FUNCTION_POINTER_TAG;
 }
 
 bool isinteger(ref_t obj) {
-  return isfixnum(obj) /* || isbignum(obj)*/;
+  return isfixnum(obj) || isbignum(obj);
 }
 
 bool islist(ref_t obj) {
@@ -85,6 +214,10 @@ bool ismacro(ref_t obj) {
   return isfunction(obj) && FN(obj)->tag == MACRO_TAG;
 }
 
+bool isnumber(ref_t obj) {
+  return isinteger(obj) || isflonum(obj);
+}
+
 bool isnil(ref_t obj) {
   return obj == NIL;
 }
@@ -97,6 +230,12 @@ bool isspecialform(ref_t obj) {
   return isfunction(obj) && FN(obj)->tag == SPECIAL_FORM_TAG;
 }
 
+bool issite(ref_t obj) {
+  if (LOWTAG(obj) != OTHER_POINTER_TAG)
+    return NO;
+  return SITE(obj)->tag == SITE_TAG;
+}
+
 bool isstring(ref_t obj) {
   if (LOWTAG(obj) != OTHER_POINTER_TAG)
     return NO;
@@ -113,6 +252,22 @@ bool istrue(ref_t obj) {
   return obj == TRUE;
 }
 
+bool istemplate(ref_t obj) {
+  return isfunction(obj) && FN(obj)->tag == TEMPLATE_TAG;
+}
+
+bool isvarref(ref_t obj) {
+  if (LOWTAG(obj) != OTHER_POINTER_TAG)
+    return NO;
+  return VARREF(obj)->tag == VARREF_TAG;
+}
+
+bool isvector(ref_t obj) {
+  if (LOWTAG(obj) != OTHER_POINTER_TAG)
+    return NO;
+  return VECTOR(obj)->tag == VECTOR_TAG;
+}
+
 /**
  ** Type Checks
  **/
@@ -124,6 +279,10 @@ static ref_t check(bool (*test)(ref_t), const char *msg, ref_t obj) {
   return obj;
 }
 
+ref_t check_builder(ref_t obj) {
+  return check(isbuilder, "not a string builder", obj);
+}
+
 ref_t check_function(ref_t obj) {
   return check(isfunction, "not a function", obj);
 }
@@ -132,10 +291,18 @@ ref_t check_integer(ref_t obj) {
   return check(isinteger, "not an integer", obj);
 }
 
+ref_t check_number(ref_t obj) {
+  return check(isnumber, "not a number", obj);
+}
+
 ref_t check_list(ref_t obj) {
   return check(islist, "not a list", obj);
 }
 
+ref_t check_string(ref_t obj) {
+  return check(isstring, "not a string", obj);
+}
+
 ref_t check_symbol(ref_t obj) {
   return check(issymbol, "not a symbol", obj);
 }
@@ -148,20 +315,33 @@ inline ref_t make_ref(ref_t ptr, uint8_t lowtag) {
   return ptr + lowtag;
 }
 
+ref_t bytecode(const int *ops, size_t length, ref_t consts) {
+  ref_t obj = gc_alloc(BYTECODE_SIZE(length), OTHER_POINTER_TAG);
+  BYTECODE(obj)->tag = BYTECODE_TAG;
+  BYTECODE(obj)->consts = consts;
+  BYTECODE(obj)->length = length;
+  memcpy(BYTECODE(obj)->ops, ops, length * sizeof(int));
+  return obj;
+}
+
 ref_t cons(ref_t car, ref_t cdr) {
   ref_t obj = gc_alloc(sizeof(struct cons), LIST_POINTER_TAG);
   CONS(obj)->car = car, CONS(obj)->cdr = cdr;
   return obj;
 }
 
-#define FIXNUM_MAX  536870911
-#define FIXNUM_MIN -536870912
+/* a fixnum is its value shifted left two bits, so it gets all but two
+   bits of the word: 62 on LP64 */
+#define FIXNUM_MAX (LONG_MAX >> 2)
+#define FIXNUM_MIN (LONG_MIN >> 2)
+#define FIXNUM(i) ((ref_t) (i) << 2)
+
+static ref_t int64_integer(int64_t i);
 
-ref_t integer(int i) {
+ref_t integer(int64_t i) {
   if (FIXNUM_MIN <= i && i <= FIXNUM_MAX)
-    return i << 2;
-  error("bignums are not yet supported");
-  return NIL;
+    return FIXNUM(i);
+  return int64_integer(i);
 }
 
 static ref_t alloc_function(fn_t fn, ref_t formals, ref_t body, ref_t closure, size_t arity, bool rest) {
@@ -171,6 +351,8 @@ static ref_t alloc_function(fn_t fn, ref_t formals, ref_t body, ref_t closure, s
   FN(obj)->formals = formals;
   FN(obj)->body = body;
   FN(obj)->closure = closure;
+  FN(obj)->code = NIL;
+  FN(obj)->epoch = 0;
   FN(obj)->arity = arity;
   FN(obj)->rest = rest;
   return obj;
@@ -180,22 +362,98 @@ ref_t lambda(ref_t formals, ref_t body, ref_t closure, int arity, bool rest) {
   return alloc_function(NULL, formals, body, closure, arity, rest);
 }
 
-ref_t builtin(ref_t formals, fn_t body, int arity, bool rest) {
-  return alloc_function(body, formals, NIL, NIL, arity, rest);
+ref_t builtin(fn_t body, int arity, bool rest) {
+  assert(arity <= MAX_BUILTIN_ARITY);
+  return alloc_function(body, NIL, NIL, NIL, arity, rest);
+}
+
+ref_t template(ref_t formals, ref_t body, int arity, bool rest) {
+  ref_t obj = alloc_function(NULL, formals, body, NIL, arity, rest);
+  FN(obj)->tag = TEMPLATE_TAG;
+  return obj;
+}
+
+ref_t instantiate(ref_t tmpl, ref_t closure) {
+  assert(istemplate(tmpl));
+  ref_t obj = alloc_function(NULL, FN(tmpl)->formals, FN(tmpl)->body, closure,
+                             FN(tmpl)->arity, FN(tmpl)->rest);
+  FN(obj)->code = FN(tmpl)->code;
+  FN(obj)->epoch = FN(tmpl)->epoch;
+  return obj;
+}
+
+ref_t site(ref_t form, ref_t scope) {
+  ref_t obj = gc_alloc(sizeof(struct site), OTHER_POINTER_TAG);
+  SITE(obj)->tag = SITE_TAG;
+  SITE(obj)->form = form;
+  SITE(obj)->scope = scope;
+  SITE(obj)->code = UNBOUND;
+  SITE(obj)->epoch = 0;
+  SITE(obj)->fn = UNBOUND;
+  SITE(obj)->fn_epoch = 0;
+  return obj;
+}
+
+ref_t flonum(double d) {
+  ref_t obj = gc_alloc(sizeof(struct flonum), OTHER_POINTER_TAG);
+  FLONUM(obj)->tag = FLONUM_TAG;
+  FLONUM(obj)->value = d;
+  return obj;
 }
 
 ref_t string(const char *str) {
-  ref_t obj = gc_alloc(sizeof(struct string) + strlen(str), OTHER_POINTER_TAG);
+  return string_from_bytes(str, strlen(str));
+}
+
+/* with its bytes left for the caller to fill in */
+static ref_t alloc_string(size_t length) {
+  ref_t obj = gc_alloc(sizeof(struct string) + length, OTHER_POINTER_TAG);
   STRING(obj)->tag = STRING_TAG;
-  strcpy(STRING(obj)->bytes, str);
+  STRING(obj)->length = length;
+  STRING(obj)->bytes[length] = 0;
+  return obj;
+}
+
+ref_t string_from_bytes(const char *bytes, size_t length) {
+  ref_t obj = alloc_string(length);
+  memcpy(STRING(obj)->bytes, bytes, length);
+  return obj;
+}
+
+ref_t string_builder() {
+  ref_t obj = gc_alloc(sizeof(struct builder), OTHER_POINTER_TAG);
+  BUILDER(obj)->tag = BUILDER_TAG;
+  BUILDER(obj)->length = BUILDER(obj)->fill = 0;
+  BUILDER(obj)->chunks = BUILDER(obj)->tail = NIL;
   return obj;
 }
 
 ref_t symbol(const char *str) {
-  ref_t obj = gc_alloc(sizeof(struct symbol) + strlen(str), OTHER_POINTER_TAG);
+  size_t length = strlen(str);
+  ref_t obj = gc_alloc(sizeof(struct symbol) + length, OTHER_POINTER_TAG);
   SYMBOL(obj)->tag = SYMBOL_TAG;
+  SYMBOL(obj)->hash = strhash(str);
   SYMBOL(obj)->fvalue = SYMBOL(obj)->value = UNBOUND;
-  strcpy(SYMBOL(obj)->name, str);
+  memcpy(SYMBOL(obj)->name, str, length + 1);
+  return obj;
+}
+
+ref_t varref(int depth, size_t index, ref_t symbol) {
+  ref_t obj = gc_alloc(sizeof(struct varref), OTHER_POINTER_TAG);
+  VARREF(obj)->tag = VARREF_TAG;
+  VARREF(obj)->depth = depth;
+  VARREF(obj)->index = index;
+  VARREF(obj)->symbol = symbol;
+  return obj;
+}
+
+ref_t vector(size_t length, ref_t fill) {
+  size_t i;
+  ref_t obj = gc_alloc(VECTOR_SIZE(length), OTHER_POINTER_TAG);
+  VECTOR(obj)->tag = VECTOR_TAG;
+  VECTOR(obj)->length = length;
+  for (i = 0; i < length; i++)
+    VECTOR(obj)->items[i] = fill;
   return obj;
 }
 
@@ -203,44 +461,262 @@ ref_t symbol(const char *str) {
  ** Integers
  **/
 
-static int fixnum_to_int(ref_t obj) {
+static int64_t fixnum_value(ref_t obj) {
   assert(isfixnum(obj));
-  return ((int32_t) obj) >> 2;
+  return ((long) obj) >> 2;
 }
 
-int intvalue(ref_t obj) {
+/* an integer as a sign and a magnitude, which for a fixnum is kept
+   in buf */
+struct mag {
+  bool negative;
+  const limb_t *limbs;
+  size_t length;
+  limb_t buf[2];
+};
+
+static void to_mag(ref_t obj, struct mag *m) {
+  if (isfixnum(obj)) {
+    int64_t i = fixnum_value(obj);
+    uint64_t u = i < 0 ? -(uint64_t) i : (uint64_t) i;
+    m->negative = i < 0;
+    m->buf[0] = (limb_t) u, m->buf[1] = (limb_t) (u >> LIMB_BITS);
+    m->limbs = m->buf;
+    m->length = mag_length(m->buf, 2);
+  } else {
+    m->negative = BIGNUM(obj)->negative;
+    m->limbs = BIGNUM(obj)->limbs;
+    m->length = BIGNUM(obj)->length;
+  }
+}
+
+/* the integer with the given sign and magnitude, which is a fixnum
+   whenever it fits in one */
+static ref_t make_integer(bool negative, const limb_t *limbs, size_t n) {
+  ref_t obj;
+  uint64_t u;
+  n = mag_length(limbs, n);
+  if (n <= 2) {
+    u = n == 0 ? 0 : limbs[0];
+    if (n == 2)
+      u |= (uint64_t) limbs[1] << LIMB_BITS;
+    if (!negative && u <= FIXNUM_MAX)
+      return FIXNUM(u);
+    if (negative && u <= -(int64_t) FIXNUM_MIN)
+      return FIXNUM(-(int64_t) u);
+  }
+  obj = gc_alloc(BIGNUM_SIZE(n), OTHER_POINTER_TAG);
+  BIGNUM(obj)->tag = BIGNUM_TAG;
+  BIGNUM(obj)->negative = negative;
+  BIGNUM(obj)->length = n;
+  memcpy(BIGNUM(obj)->limbs, limbs, n * sizeof(limb_t));
+  return obj;
+}
+
+static ref_t int64_integer(int64_t i) {
+  uint64_t u = i < 0 ? -(uint64_t) i : (uint64_t) i;
+  limb_t limbs[2] = { (limb_t) u, (limb_t) (u >> LIMB_BITS) };
+  return make_integer(i < 0, limbs, 2);
+}
+
+/* with the same prefixes as strtoll: 0x for hex and 0 for octal */
+ref_t integer_from_string(const char *str) {
+  const char *digits = str;
+  bool negative = (*digits == '-');
+  int base = 10, digit;
+  size_t n;
+  limb_t *limbs;
+  ref_t result;
+  if (*digits == '-' || *digits == '+')
+    digits++;
+  if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X') && digits[2])
+    base = 16, digits += 2;
+  else if (digits[0] == '0' && digits[1])
+    base = 8, digits++;
+  /* every limb holds at least eight digits in any of these */
+  n = strlen(digits) / 8 + 1;
+  limbs = safe_malloc(n * sizeof(limb_t));
+  memset(limbs, 0, n * sizeof(limb_t));
+  for (; *digits; digits++) {
+    if (isdigit((unsigned char) *digits))
+      digit = *digits - '0';
+    else if (isxdigit((unsigned char) *digits))
+      digit = tolower((unsigned char) *digits) - 'a' + 10;
+    else
+      digit = base;
+    if (digit >= base) {
+      free(limbs);
+      error("invalid integer: '%s'", str);
+    }
+    mag_muladd_1(limbs, n, base, digit);
+  }
+  result = make_integer(negative, limbs, n);
+  free(limbs);
+  return result;
+}
+
+char *integer_to_string(ref_t obj) {
+  struct mag m;
+  size_t n, len = 0, i;
+  limb_t *q, chunk;
+  char *str, ch;
+  int digits;
+  assert(isinteger(obj));
+  to_mag(obj, &m);
+  n = m.length;
+  /* a limb has at most ten digits */
+  str = safe_malloc(n * 10 + 3);
+  q = safe_malloc((n + 1) * sizeof(limb_t));
+  memcpy(q, m.limbs, n * sizeof(limb_t));
+  /* the digits come out least significant first, nine at a time */
+  do {
+    chunk = mag_divmod_1(q, q, n, 1000000000);
+    n = mag_length(q, n);
+    for (digits = 0; digits < 9 && (n || chunk); digits++) {
+      str[len++] = '0' + chunk % 10;
+      chunk /= 10;
+    }
+  } while (n);
+  if (len == 0)
+    str[len++] = '0';
+  if (m.negative)
+    str[len++] = '-';
+  for (i = 0; i < len / 2; i++)
+    ch = str[i], str[i] = str[len - i - 1], str[len - i - 1] = ch;
+  str[len] = 0;
+  free(q);
+  return str;
+}
+
+int64_t intvalue(ref_t obj) {
+  struct mag m;
+  uint64_t u;
   assert(isinteger(obj));
   if (isfixnum(obj))
-    return fixnum_to_int(obj);
-  abort();
+    return fixnum_value(obj);
+  to_mag(obj, &m);
+  if (m.length <= 2) {
+    u = m.limbs[0] | (m.length == 2 ? (uint64_t) m.limbs[1] << LIMB_BITS : 0);
+    if (!m.negative && u <= INT64_MAX)
+      return u;
+    if (m.negative && u <= (uint64_t) INT64_MAX + 1)
+      return u == (uint64_t) INT64_MAX + 1 ? INT64_MIN : -(int64_t) u;
+  }
+  error("integer out of range");
+  return 0;
+}
+
+/**
+ * Fixnums are their value shifted left two bits, so adding two of
+ * them is adding the words, and the words overflow exactly when the
+ * sum is not a fixnum. The fast paths only need the compiler's
+ * overflow checks; everything else goes through the magnitudes.
+ */
+
+static ref_t add_slow(ref_t x, ref_t y, bool negate) {
+  struct mag a, b;
+  limb_t *r;
+  size_t n;
+  ref_t result;
+  to_mag(x, &a), to_mag(y, &b);
+  if (negate)
+    b.negative = !b.negative;
+  n = (a.length > b.length ? a.length : b.length) + 1;
+  r = safe_malloc(n * sizeof(limb_t));
+  if (a.negative == b.negative) {
+    mag_add(r, a.limbs, a.length, b.limbs, b.length);
+    result = make_integer(a.negative, r, n);
+  } else if (mag_cmp(a.limbs, a.length, b.limbs, b.length) >= 0) {
+    mag_sub(r, a.limbs, a.length, b.limbs, b.length);
+    result = make_integer(a.negative, r, a.length);
+  } else {
+    mag_sub(r, b.limbs, b.length, a.limbs, a.length);
+    result = make_integer(b.negative, r, b.length);
+  }
+  free(r);
+  return result;
+}
+
+static ref_t mul_slow(ref_t x, ref_t y) {
+  struct mag a, b;
+  limb_t *r;
+  ref_t result;
+  to_mag(x, &a), to_mag(y, &b);
+  r = safe_malloc((a.length + b.length + 1) * sizeof(limb_t));
+  mag_mul(r, a.limbs, a.length, b.limbs, b.length);
+  result = make_integer(a.negative != b.negative, r, a.length + b.length);
+  free(r);
+  return result;
+}
+
+/* truncates towards zero, like C */
+static ref_t div_slow(ref_t x, ref_t y) {
+  struct mag a, b;
+  limb_t *q;
+  size_t n;
+  ref_t result;
+  to_mag(x, &a), to_mag(y, &b);
+  if (mag_cmp(a.limbs, a.length, b.limbs, b.length) < 0)
+    return FIXNUM(0);
+  n = a.length - b.length + 1;
+  q = safe_malloc(n * sizeof(limb_t));
+  mag_divmod(q, NULL, a.limbs, a.length, b.limbs, b.length);
+  result = make_integer(a.negative != b.negative, q, n);
+  free(q);
+  return result;
 }
 
 ref_t integer_add(ref_t x, ref_t y) {
+  long r;
   assert(isinteger(x) && isinteger(y));
-  if (isfixnum(x) && isfixnum(y))
-    return x + y;
-  abort();
+  if (isfixnum(x) && isfixnum(y) && !__builtin_add_overflow((long) x, (long) y, &r))
+    return (ref_t) r;
+  return add_slow(x, y, NO);
 }
 
 ref_t integer_sub(ref_t x, ref_t y) {
+  long r;
   assert(isinteger(x) && isinteger(y));
-  if (isfixnum(x) && isfixnum(y))
-    return x - y;
-  abort();
+  if (isfixnum(x) && isfixnum(y) && !__builtin_sub_overflow((long) x, (long) y, &r))
+    return (ref_t) r;
+  return add_slow(x, y, YES);
 }
 
 ref_t integer_mul(ref_t x, ref_t y) {
+  long r;
   assert(isinteger(x) && isinteger(y));
-  if (isfixnum(x) && isfixnum(y))
-    return integer(fixnum_to_int(x) * fixnum_to_int(y));
-  abort();
+  if (isfixnum(x) && isfixnum(y) &&
+      !__builtin_mul_overflow((long) x, (long) fixnum_value(y), &r))
+    return (ref_t) r;
+  return mul_slow(x, y);
 }
 
 ref_t integer_div(ref_t x, ref_t y) {
   assert(isinteger(x) && isinteger(y));
+  if (y == FIXNUM(0))
+    error("division by zero");
   if (isfixnum(x) && isfixnum(y))
-    return integer(fixnum_to_int(x) / fixnum_to_int(y));
-  abort();
+    return integer(fixnum_value(x) / fixnum_value(y));
+  return div_slow(x, y);
+}
+
+/**
+ ** Flonums
+ **/
+
+double numvalue(ref_t obj) {
+  struct mag m;
+  double d = 0;
+  size_t i;
+  assert(isnumber(obj));
+  if (isflonum(obj))
+    return FLONUM(obj)->value;
+  if (isfixnum(obj))
+    return fixnum_value(obj);
+  to_mag(obj, &m);
+  for (i = m.length; i-- > 0;)
+    d = d * 4294967296.0 + m.limbs[i];
+  return m.negative ? -d : d;
 }
 
 /**
@@ -272,11 +748,13 @@ ref_t cddr(ref_t list) {
 void set_car(ref_t cons, ref_t value) {
   assert(iscons(cons));
   CONS(cons)->car = value;
+  gc_write_barrier(cons, value);
 }
 
 void set_cdr(ref_t cons, ref_t value) {
   assert(iscons(cons));
   CONS(cons)->cdr = value;
+  gc_write_barrier(cons, value);
 }
 
 static int list_length(ref_t obj) {
@@ -303,6 +781,16 @@ ref_t getclosure(ref_t obj) {
   return FN(obj)->closure;
 }
 
+ref_t getcode(ref_t obj) {
+  assert(isfunction(obj));
+  return FN(obj)->code;
+}
+
+size_t getepoch(ref_t obj) {
+  assert(isfunction(obj));
+  return FN(obj)->epoch;
+}
+
 fn_t getfn(ref_t obj) {
   assert(isfunction(obj));
   return FN(obj)->fn;
@@ -328,9 +816,37 @@ bool isbuiltin(ref_t obj) {
   return FN(obj)->fn != NULL;
 }
 
+void setfn(ref_t obj, fn_t fn) {
+  assert(isfunction(obj));
+  FN(obj)->fn = fn;
+}
+
+void set_code(ref_t obj, ref_t code) {
+  assert(isfunction(obj));
+  FN(obj)->code = code;
+  FN(obj)->epoch = epoch;
+  gc_write_barrier(obj, code);
+}
+
+size_t macro_epoch() {
+  return epoch;
+}
+
+void get_epochs(size_t *macro, size_t *function) {
+  *macro = epoch, *function = function_epoch;
+}
+
+void skip_epochs(size_t macro, size_t function) {
+  if (epoch <= macro)
+    epoch = macro + 1;
+  if (function_epoch <= function)
+    function_epoch = function + 1;
+}
+
 ref_t set_type_macro(ref_t obj) {
   assert(isfunction(obj));
   FN(obj)->tag = MACRO_TAG;
+  epoch++;
   return obj;
 }
 
@@ -358,7 +874,11 @@ ref_t get_function(ref_t symbol) {
 
 void set_function(ref_t symbol, ref_t value) {
   assert(issymbol(symbol));
+  if (ismacro(value) || ismacro(SYMBOL(symbol)->fvalue))
+    epoch++;
+  function_epoch++;
   SYMBOL(symbol)->fvalue = value;
+  gc_write_barrier(symbol, value);
 }
 
 bool has_value(ref_t symbol) {
@@ -376,8 +896,200 @@ ref_t get_value(ref_t symbol) {
 void set_value(ref_t symbol, ref_t value) {
   assert(issymbol(symbol));
   SYMBOL(symbol)->value = value;
+  gc_write_barrier(symbol, value);
+}
+
+size_t symbol_hash(ref_t symbol) {
+  assert(issymbol(symbol));
+  return SYMBOL(symbol)->hash;
+}
+
+/**
+ ** Bytecode
+ **/
+
+ref_t bytecode_consts(ref_t obj) {
+  assert(isbytecode(obj));
+  return BYTECODE(obj)->consts;
+}
+
+const int *bytecode_ops(ref_t obj) {
+  assert(isbytecode(obj));
+  return BYTECODE(obj)->ops;
+}
+
+/**
+ ** Call Sites
+ **/
+
+ref_t site_form(ref_t obj) {
+  assert(issite(obj));
+  return SITE(obj)->form;
+}
+
+ref_t site_scope(ref_t obj) {
+  assert(issite(obj));
+  return SITE(obj)->scope;
+}
+
+ref_t site_function(ref_t obj) {
+  assert(issite(obj));
+  if (SITE(obj)->fn == UNBOUND || SITE(obj)->fn_epoch != function_epoch) {
+    SITE(obj)->fn = get_function(check_symbol(car(SITE(obj)->form)));
+    SITE(obj)->fn_epoch = function_epoch;
+    gc_write_barrier(obj, SITE(obj)->fn);
+  }
+  return SITE(obj)->fn;
+}
+
+ref_t site_code(ref_t obj) {
+  assert(issite(obj));
+  return SITE(obj)->epoch == epoch ? SITE(obj)->code : UNBOUND;
+}
+
+void set_site_code(ref_t obj, ref_t code, size_t expanded_at) {
+  assert(issite(obj));
+  SITE(obj)->code = code;
+  SITE(obj)->epoch = expanded_at;
+  gc_write_barrier(obj, code);
+}
+
+/**
+ ** Variable References
+ **/
+
+int varref_depth(ref_t obj) {
+  assert(isvarref(obj));
+  return VARREF(obj)->depth;
+}
+
+size_t varref_index(ref_t obj) {
+  assert(isvarref(obj));
+  return VARREF(obj)->index;
+}
+
+ref_t varref_symbol(ref_t obj) {
+  assert(isvarref(obj));
+  return VARREF(obj)->symbol;
+}
+
+/**
+ ** Vectors
+ **/
+
+size_t vector_length(ref_t obj) {
+  assert(isvector(obj));
+  return VECTOR(obj)->length;
+}
+
+ref_t vector_ref(ref_t obj, size_t i) {
+  assert(isvector(obj) && i < VECTOR(obj)->length);
+  return VECTOR(obj)->items[i];
+}
+
+void vector_set(ref_t obj, size_t i, ref_t value) {
+  assert(isvector(obj) && i < VECTOR(obj)->length);
+  VECTOR(obj)->items[i] = value;
+  gc_write_barrier(obj, value);
+}
+
+/**
+ ** Strings
+ **/
+
+size_t string_length(ref_t obj) {
+  if (isbuilder(obj))
+    return BUILDER(obj)->length;
+  assert(isstring(obj));
+  return STRING(obj)->length;
 }
 
+ref_t concat(ref_t strings) {
+  size_t length = 0;
+  ref_t rest, str, result;
+  char *p;
+  for (rest = strings; !isnil(rest); rest = cdr(rest))
+    length += STRING(flatten(car(rest)))->length;
+  result = alloc_string(length);
+  p = STRING(result)->bytes;
+  for (rest = strings; !isnil(rest); rest = cdr(rest)) {
+    str = flatten(car(rest));
+    memcpy(p, STRING(str)->bytes, STRING(str)->length);
+    p += STRING(str)->length;
+  }
+  return result;
+}
+
+/* appends at least this long are shared rather than copied */
+#define SHARED_LENGTH 256
+#define MIN_CHUNK 64
+#define MAX_CHUNK 65536
+
+static void push_chunk(ref_t obj, ref_t chunk) {
+  BUILDER(obj)->chunks = cons(chunk, BUILDER(obj)->chunks);
+  gc_write_barrier(obj, BUILDER(obj)->chunks);
+}
+
+/* pushes what is in the tail, if anything, and starts over without one */
+static void seal(ref_t obj) {
+  struct builder *b = BUILDER(obj);
+  if (b->fill == 0)
+    return;
+  push_chunk(obj, b->fill == STRING(b->tail)->length
+             ? b->tail : string_from_bytes(STRING(b->tail)->bytes, b->fill));
+  b->tail = NIL, b->fill = 0;
+}
+
+void builder_append(ref_t obj, ref_t str) {
+  struct builder *b = BUILDER(obj);
+  const char *bytes = STRING(str)->bytes;
+  size_t n = STRING(str)->length, size, run;
+  b->length += n;
+  if (n >= SHARED_LENGTH) {
+    seal(obj);
+    push_chunk(obj, str);
+    return;
+  }
+  while (n > 0) {
+    if (isnil(b->tail) || b->fill == STRING(b->tail)->length) {
+      size = isnil(b->tail) ? MIN_CHUNK : 2 * STRING(b->tail)->length;
+      seal(obj);
+      b->tail = alloc_string(size < MAX_CHUNK ? size : MAX_CHUNK);
+      gc_write_barrier(obj, b->tail);
+    }
+    run = STRING(b->tail)->length - b->fill;
+    if (run > n)
+      run = n;
+    memcpy(STRING(b->tail)->bytes + b->fill, bytes, run);
+    b->fill += run, bytes += run, n -= run;
+  }
+}
+
+ref_t flatten(ref_t obj) {
+  struct builder *b;
+  ref_t flat, rest;
+  char *end;
+  if (isstring(obj))
+    return obj;
+  if (!isbuilder(obj))
+    error("not a string");
+  b = BUILDER(obj);
+  if (b->fill == 0 && iscons(b->chunks) && isnil(cdr(b->chunks)))
+    return car(b->chunks);
+  flat = alloc_string(b->length);
+  end = STRING(flat)->bytes + b->length;
+  end -= b->fill;
+  if (b->fill)
+    memcpy(end, STRING(b->tail)->bytes, b->fill);
+  for (rest = b->chunks; !isnil(rest); rest = cdr(rest)) {
+    end -= STRING(car(rest))->length;
+    memcpy(end, STRING(car(rest))->bytes, STRING(car(rest))->length);
+  }
+  b->tail = NIL, b->fill = 0;
+  b->chunks = cons(flat, NIL);
+  gc_write_barrier(obj, b->chunks);
+  return flat;
+}
 
 /**
  ** Misc
@@ -388,7 +1100,7 @@ int length(ref_t obj) {
   if (islist(obj))
     return list_length(obj);
   else
-    return strlen(strvalue(obj));
+    return string_length(obj);
 }
 
 static const char *string_to_str(ref_t obj) {
@@ -408,3 +1120,101 @@ const char *strvalue(ref_t obj) {
     return symbol_to_str(obj);
   abort();
 }
+
+/* FNV-1a */
+size_t strhash(const char *str) {
+  size_t hash = 2166136261u;
+  for (; *str; str++)
+    hash = (hash ^ (unsigned char) *str) * 16777619u;
+  return hash;
+}
+
+/**
+ ** Garbage Collection
+ **/
+
+size_t object_size(ref_t obj) {
+  switch (LOWTAG(obj)) {
+  case LIST_POINTER_TAG:
+    return sizeof(struct cons);
+  case FUNCTION_POINTER_TAG:
+    return sizeof(struct function);
+  case OTHER_POINTER_TAG:
+    if (isstring(obj))
+      return sizeof(struct string) + STRING(obj)->length;
+    if (issymbol(obj))
+      return sizeof(struct symbol) + strlen(SYMBOL(obj)->name);
+    if (isvector(obj))
+      return VECTOR_SIZE(VECTOR(obj)->length);
+    if (isvarref(obj))
+      return sizeof(struct varref);
+    if (isbytecode(obj))
+      return BYTECODE_SIZE(BYTECODE(obj)->length);
+    if (issite(obj))
+      return sizeof(struct site);
+    if (isbignum(obj))
+      return BIGNUM_SIZE(BIGNUM(obj)->length);
+    if (isflonum(obj))
+      return sizeof(struct flonum);
+    if (isbuilder(obj))
+      return sizeof(struct builder);
+  }
+  abort();
+}
+
+void trace_object(ref_t obj, gc_visit_t visit) {
+  switch (LOWTAG(obj)) {
+  case LIST_POINTER_TAG:
+    visit(&CONS(obj)->car);
+    visit(&CONS(obj)->cdr);
+    break;
+  case FUNCTION_POINTER_TAG:
+    visit(&FN(obj)->formals);
+    visit(&FN(obj)->body);
+    visit(&FN(obj)->closure);
+    visit(&FN(obj)->code);
+    break;
+  case OTHER_POINTER_TAG:
+    if (issymbol(obj)) {
+      visit(&SYMBOL(obj)->value);
+      visit(&SYMBOL(obj)->fvalue);
+    } else if (isvector(obj)) {
+      size_t i;
+      for (i = 0; i < VECTOR(obj)->length; i++)
+        visit(&VECTOR(obj)->items[i]);
+    } else if (isvarref(obj))
+      visit(&VARREF(obj)->symbol);
+    else if (isbytecode(obj))
+      visit(&BYTECODE(obj)->consts);
+    else if (isbuilder(obj)) {
+      visit(&BUILDER(obj)->chunks);
+      visit(&BUILDER(obj)->tail);
+    } else if (issite(obj)) {
+      visit(&SITE(obj)->form);
+      visit(&SITE(obj)->scope);
+      visit(&SITE(obj)->code);
+      visit(&SITE(obj)->fn);
+    }
+    break;
+  default:
+    abort();
+  }
+}
+
+void object_layout(uint32_t *layout) {
+  const uint32_t values[] = {
+    sizeof(struct cons), sizeof(struct function), sizeof(struct string),
+    sizeof(struct symbol), VECTOR_SIZE(0), sizeof(struct varref),
+    BYTECODE_SIZE(0), sizeof(struct site), BIGNUM_SIZE(0),
+    sizeof(struct flonum), sizeof(struct builder), sizeof(ref_t),
+    gc_header_size(),
+    STRING_TAG, SYMBOL_TAG, FUNCTION_TAG, MACRO_TAG, SPECIAL_FORM_TAG,
+    VECTOR_TAG, VARREF_TAG, TEMPLATE_TAG, BYTECODE_TAG, SITE_TAG,
+    BIGNUM_TAG, FLONUM_TAG, BUILDER_TAG,
+    CONTINUATION_POINTER_TAG, LIST_POINTER_TAG, FUNCTION_POINTER_TAG,
+    OTHER_POINTER_TAG, NIL, TRUE, UNBOUND, FIXNUM(1)
+  };
+  assert(sizeof(values) <= LAYOUT_SIZE * sizeof(uint32_t));
+  memset(layout, 0, LAYOUT_SIZE * sizeof(uint32_t));
+  memcpy(layout, values, sizeof(values));
+}
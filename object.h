@@ -2,6 +2,7 @@
 #define OBJECT_H
 
 #include <sys/types.h>
+#include "gc.h"
 #include "types.h"
 
 /* Special Immediate Values:
@@ -15,51 +16,90 @@
 #define UNBOUND 0xFE
 
 /* Type Predicates */
+bool isbignum(ref_t obj);
+bool isbuilder(ref_t obj);
+bool isbytecode(ref_t obj);
 bool iscons(ref_t obj);
 bool isfixnum(ref_t obj);
+bool isflonum(ref_t obj);
 bool isfunction(ref_t obj);
 bool isinteger(ref_t obj);
 bool islist(ref_t obj);
 bool ismacro(ref_t obj);
 bool isnil(ref_t obj);
+bool isnumber(ref_t obj);
 bool ispointer(ref_t obj);
+bool issite(ref_t obj);
 bool isspecialform(ref_t obj);
 bool isstring(ref_t obj);
 bool issymbol(ref_t obj);
+bool istemplate(ref_t obj);
 bool istrue(ref_t obj);
+bool isvarref(ref_t obj);
+bool isvector(ref_t obj);
 
 /* Type Checks */
+ref_t check_builder(ref_t obj);
 ref_t check_function(ref_t obj);
 ref_t check_integer(ref_t obj);
 ref_t check_list(ref_t obj);
+ref_t check_number(ref_t obj);
+ref_t check_string(ref_t obj);
 ref_t check_symbol(ref_t obj);
 
 /* Constructors */
+ref_t bytecode(const int *ops, size_t length, ref_t consts);
 ref_t cons(ref_t car, ref_t cdr);
-ref_t integer(int i);
+ref_t flonum(double d);
+ref_t integer(int64_t i);
 ref_t lambda(ref_t formals, ref_t body, ref_t closure, int arity, bool rest);
-ref_t builtin(ref_t formals, fn_t body, int arity, bool rest);
+/* builtins take at most this many arguments, plus a rest */
+#define MAX_BUILTIN_ARITY 3
+ref_t builtin(fn_t body, int arity, bool rest);
+ref_t site(ref_t form, ref_t scope);
+ref_t template(ref_t formals, ref_t body, int arity, bool rest);
+ref_t instantiate(ref_t tmpl, ref_t closure);
 ref_t string(const char *str);
+ref_t string_from_bytes(const char *bytes, size_t length);
+ref_t string_builder();
 ref_t symbol(const char *str);
+ref_t varref(int depth, size_t index, ref_t symbol);
+ref_t vector(size_t length, ref_t fill);
 
 /* Functions */
 ref_t getbody(ref_t obj);
 ref_t getclosure(ref_t obj);
+ref_t getcode(ref_t obj);
+size_t getepoch(ref_t obj);
 fn_t getfn(ref_t obj);
 ref_t getformals(ref_t obj);
 size_t getarity(ref_t obj);
 bool hasrest(ref_t obj);
 bool isbuiltin(ref_t obj);
+void set_code(ref_t obj, ref_t code);
+void setfn(ref_t obj, fn_t fn);
+size_t macro_epoch();
+/* the epochs an image is saved at, and moving past them when it is
+   loaded so that everything it cached is stale */
+void get_epochs(size_t *macro, size_t *function);
+void skip_epochs(size_t macro, size_t function);
 ref_t set_type_macro(ref_t obj);
 ref_t set_type_special_form(ref_t obj);
 
 /* Integers */
-int intvalue(ref_t obj);
+int64_t intvalue(ref_t obj);
+ref_t integer_from_string(const char *str);
+/* returns a string the caller must free */
+char *integer_to_string(ref_t obj);
 ref_t integer_add(ref_t x, ref_t y);
 ref_t integer_sub(ref_t x, ref_t y);
 ref_t integer_mul(ref_t x, ref_t y);
 ref_t integer_div(ref_t x, ref_t y);
 
+/* Flonums */
+/* the value of any number as a double */
+double numvalue(ref_t obj);
+
 /* Lists */
 ref_t car(ref_t list);
 ref_t cadr(ref_t list);
@@ -78,8 +118,57 @@ bool has_value(ref_t sym);
 ref_t get_value(ref_t sym);
 void set_value(ref_t sym, ref_t func);
 
+size_t symbol_hash(ref_t sym);
+
+/* Bytecode */
+ref_t bytecode_consts(ref_t obj);
+const int *bytecode_ops(ref_t obj);
+
+/**
+ * Call Sites: a call to a named function in resolved or compiled
+ * code. A site caches the function its name is bound to until any
+ * function is redefined, and for a macro the code for its expansion.
+ * The code is UNBOUND until the call is first expanded and again
+ * after any macro is redefined.
+ */
+ref_t site_form(ref_t obj);
+ref_t site_scope(ref_t obj);
+ref_t site_function(ref_t obj);
+ref_t site_code(ref_t obj);
+void set_site_code(ref_t obj, ref_t code, size_t expanded_at);
+
+/* Variable References */
+#define GLOBAL_DEPTH -1
+int varref_depth(ref_t obj);
+size_t varref_index(ref_t obj);
+ref_t varref_symbol(ref_t obj);
+
+/* Vectors */
+size_t vector_length(ref_t obj);
+ref_t vector_ref(ref_t obj, size_t i);
+void vector_set(ref_t obj, size_t i, ref_t value);
+
+/**
+ * Strings: string_length also takes a builder. flatten returns a
+ * string as it is and a builder as the string of everything appended
+ * to it, and raises an error on anything else.
+ */
+size_t string_length(ref_t obj);
+ref_t concat(ref_t strings);
+void builder_append(ref_t obj, ref_t str);
+ref_t flatten(ref_t obj);
+
 /* Misc */
 int length(ref_t obj);
+/* the bytes of a string or the name of a symbol, terminated */
 const char *strvalue(ref_t obj);
+size_t strhash(const char *str);
+
+/* Garbage Collection */
+size_t object_size(ref_t obj);
+void trace_object(ref_t obj, gc_visit_t visit);
+/* the sizes and tags a saved heap depends on, zero padded */
+#define LAYOUT_SIZE 40
+void object_layout(uint32_t *layout);
 
 #endif
@@ -1,46 +1,239 @@
+#include "alloc.h"
 #include "error.h"
 #include "object.h"
 #include "print.h"
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
-static void printlist(ref_t obj) {
-  ref_t thecar = car(obj);
-  ref_t thecdr = cdr(obj);
-  print(thecar);
-  if (isnil(thecdr))
-    ;
-  else if (iscons(thecdr)) {
-    putchar(' ');
-    printlist(thecdr);
-  } else {
-    printf(" . ");
-    print(thecdr);
+/**
+ ** Sinks
+ **/
+
+/* file and descriptor sinks are written to this many bytes at a time */
+#define SINK_SIZE 65536
+
+enum sink_kind { MEMORY_SINK, FILE_SINK, FD_SINK };
+
+struct sink {
+  enum sink_kind kind;
+  FILE *file;
+  int fd;
+  char *data;
+  size_t pos, size;
+};
+
+static sink *allocsink(enum sink_kind kind, size_t size) {
+  sink *out = safe_malloc(sizeof(sink));
+  out->kind = kind;
+  out->file = NULL, out->fd = -1;
+  out->data = safe_malloc(size);
+  out->pos = 0, out->size = size;
+  return out;
+}
+
+sink *memorysink() {
+  return allocsink(MEMORY_SINK, 256);
+}
+
+sink *filesink(FILE *file) {
+  sink *out = allocsink(FILE_SINK, SINK_SIZE);
+  out->file = file;
+  return out;
+}
+
+sink *fdsink(int fd) {
+  sink *out = allocsink(FD_SINK, SINK_SIZE);
+  out->fd = fd;
+  return out;
+}
+
+void flushsink(sink *out) {
+  const char *p = out->data;
+  ssize_t n;
+  if (out->kind == FILE_SINK) {
+    fwrite(out->data, 1, out->pos, out->file);
+    fflush(out->file);
+  } else if (out->kind == FD_SINK) {
+    while (p < out->data + out->pos) {
+      n = write(out->fd, p, out->data + out->pos - p);
+      if (n < 0 && errno != EINTR)
+        break;
+      if (n > 0)
+        p += n;
+    }
+  } else
+    return;
+  out->pos = 0;
+}
+
+void closesink(sink *out) {
+  flushsink(out);
+  free(out->data);
+  free(out);
+}
+
+void resetsink(sink *out) {
+  out->pos = 0;
+}
+
+const char *sinkbytes(sink *out, size_t *length) {
+  *length = out->pos;
+  return out->data;
+}
+
+/* makes room for n more bytes */
+static void reserve(sink *out, size_t n) {
+  if (out->size - out->pos >= n)
+    return;
+  if (out->kind != MEMORY_SINK) {
+    flushsink(out);
+    if (out->size >= n)
+      return;
   }
+  while (out->size - out->pos < n)
+    out->size *= 2;
+  out->data = safe_realloc(out->data, out->size);
 }
 
-void print(ref_t obj) {
+static inline void putbyte(sink *out, char ch) {
+  if (out->pos == out->size)
+    reserve(out, 1);
+  out->data[out->pos++] = ch;
+}
+
+void sinkwrite(sink *out, const char *bytes, size_t n) {
+  reserve(out, n);
+  memcpy(out->data + out->pos, bytes, n);
+  out->pos += n;
+}
+
+static inline void putstr(sink *out, const char *str) {
+  sinkwrite(out, str, strlen(str));
+}
+
+/**
+ ** Printing
+ **/
+
+static void printfixnum(sink *out, int64_t i) {
+  char digits[24], *p = digits + sizeof(digits);
+  uint64_t u = i < 0 ? -(uint64_t) i : (uint64_t) i;
+  do
+    *--p = '0' + u % 10;
+  while (u /= 10);
+  if (i < 0)
+    *--p = '-';
+  sinkwrite(out, p, digits + sizeof(digits) - p);
+}
+
+/* the shortest digits that read back as the same double, with a
+   point if they would otherwise read as an integer */
+static void printflonum(sink *out, double d) {
+  char digits[32];
+  int precision = 15;
+  do
+    snprintf(digits, sizeof(digits), "%.*g", precision++, d);
+  while (precision <= 17 && strtod(digits, NULL) != d);
+  if (strspn(digits, "0123456789-") == strlen(digits))
+    strcat(digits, ".0");
+  putstr(out, digits);
+}
+
+/* anything but a list */
+static void printatom(sink *out, ref_t obj) {
+  char desc[64];
   if (isnil(obj))
-    printf("nil");
+    putstr(out, "nil");
   else if (istrue(obj))
-    printf("true");
-  else if (isinteger(obj))
-    printf("%i", intvalue(obj));
-  else if (isstring(obj))
-    printf("\"%s\"", strvalue(obj));
+    putstr(out, "true");
+  else if (isfixnum(obj))
+    printfixnum(out, intvalue(obj));
+  else if (isbignum(obj)) {
+    char *digits = integer_to_string(obj);
+    putstr(out, digits);
+    free(digits);
+  }
+  else if (isflonum(obj))
+    printflonum(out, numvalue(obj));
+  else if (isstring(obj) || isbuilder(obj)) {
+    obj = flatten(obj);
+    putbyte(out, '"');
+    sinkwrite(out, strvalue(obj), string_length(obj));
+    putbyte(out, '"');
+  }
   else if (issymbol(obj))
-    printf("%s", strvalue(obj));
-  else if (iscons(obj)) {
-    putchar('(');
-    printlist(obj);
-    putchar(')');
+    putstr(out, strvalue(obj));
+  else if (isfunction(obj)) {
+    snprintf(desc, sizeof(desc), "<fn arity:%i rest:%s>",
+             (int) getarity(obj), hasrest(obj) ? "YES" : "NO");
+    putstr(out, desc);
   }
-  else if (isfunction(obj))
-    printf("<fn arity:%i rest:%s>", (int) getarity(obj), hasrest(obj) ? "YES" : "NO");
   else
     error("cannot print object");
 }
 
+/**
+ * Lists are printed without recursing. The lists that have been
+ * opened but not closed are kept on a stack, each as the cell whose
+ * car was printed last, or as UNBOUND once only the close paren of a
+ * dotted list is left.
+ */
+static ref_t *open_lists = NULL;
+static size_t open_size = 0;
+
+void printto(sink *out, ref_t obj) {
+  size_t depth = 0;
+  ref_t rest;
+  for (;;) {
+    if (isvarref(obj))
+      obj = varref_symbol(obj);
+    else if (issite(obj))
+      obj = site_form(obj);
+    if (iscons(obj)) {
+      if (depth == open_size) {
+        open_size = open_size ? open_size * 2 : 64;
+        open_lists = safe_realloc(open_lists, open_size * sizeof(ref_t));
+      }
+      putbyte(out, '(');
+      open_lists[depth++] = obj;
+      obj = car(obj);
+      continue;
+    }
+    printatom(out, obj);
+    for (; depth > 0; depth--) {
+      rest = open_lists[depth - 1];
+      if (rest != UNBOUND && !isnil(rest = cdr(rest)))
+        break;
+      putbyte(out, ')');
+    }
+    if (depth == 0)
+      return;
+    if (iscons(rest)) {
+      putbyte(out, ' ');
+      open_lists[depth - 1] = rest;
+      obj = car(rest);
+    } else {
+      putstr(out, " . ");
+      open_lists[depth - 1] = UNBOUND;
+      obj = rest;
+    }
+  }
+}
+
+void print(ref_t obj) {
+  static sink *out = NULL;
+  if (!out)
+    out = filesink(stdout);
+  /* drop whatever an earlier print that failed left behind */
+  resetsink(out);
+  printto(out, obj);
+  flushsink(out);
+}
+
 void println(ref_t obj) {
   print(obj);
   puts("");
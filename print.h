@@ -1,8 +1,31 @@
 #ifndef PRINT_H
 #define PRINT_H
 
+#include <stdio.h>
 #include "types.h"
 
+/**
+ * Sinks buffer what is printed. A memory sink grows to hold all of
+ * it; a file or descriptor sink writes it out whenever its buffer
+ * fills and when it is flushed. Closing a sink does not close its file.
+ */
+typedef struct sink sink;
+
+sink *memorysink();
+sink *filesink(FILE *file);
+sink *fdsink(int fd);
+void flushsink(sink *out);
+void closesink(sink *out);
+/* drops whatever has been written but not flushed */
+void resetsink(sink *out);
+
+/* what has been written to a memory sink, which is not terminated */
+const char *sinkbytes(sink *out, size_t *length);
+void sinkwrite(sink *out, const char *bytes, size_t n);
+
+void printto(sink *out, ref_t obj);
+
+/* to standard output */
 void print(ref_t obj);
 void println(ref_t obj);
 
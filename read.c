@@ -1,78 +1,203 @@
 #include <ctype.h>
-#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "alloc.h"
 #include "buffer.h"
 #include "object.h"
 #include "read.h"
+#include "scan.h"
 #include "env.h"
 #include "error.h"
 
-static int skipspace(FILE *in) {
-  int ch;
-  do {
-    ch = getc(in);
-    if (ch == ';') {
-      while (ch != '\n')
-        ch = getc(in);
+/**
+ * A reader scans its input in place: a regular file is mapped whole,
+ * and anything else is read a large block at a time. Tokens and
+ * strings are copied out a run at a time into the reader's scratch
+ * buffer, which is reused for every one of them.
+ */
+#define BLOCK_SIZE 65536
+
+struct reader {
+  int fd;
+  bool mapped, eof;
+  char *data;
+  size_t size;
+  const char *pos, *end;
+  buffer *scratch;
+};
+
+reader *openreader(const char *filename) {
+  struct stat st;
+  reader *in;
+  int fd = strcmp("-", filename) ? open(filename, O_RDONLY) : STDIN_FILENO;
+  if (fd < 0)
+    return NULL;
+  in = safe_malloc(sizeof(reader));
+  in->fd = fd;
+  in->mapped = in->eof = NO;
+  in->scratch = allocbuffer();
+  if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+    in->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (in->data != MAP_FAILED) {
+      madvise(in->data, st.st_size, MADV_SEQUENTIAL);
+      in->mapped = in->eof = YES;
+      in->size = st.st_size;
+      in->pos = in->data, in->end = in->data + in->size;
+      return in;
     }
-  } while(isspace(ch));
-  return ch;
+  }
+  in->size = BLOCK_SIZE;
+  in->data = safe_malloc(BLOCK_SIZE);
+  in->pos = in->end = in->data;
+  return in;
 }
 
-static ref_t readstring(FILE *in) {
-  buffer *buf = allocbuffer();
-  int ch = getc(in);
-  while (ch != '"') {
-    bufferappend(&buf, ch);
-    ch = getc(in);
+void closereader(reader *in) {
+  if (in->mapped)
+    munmap(in->data, in->size);
+  else
+    free(in->data);
+  if (in->fd != STDIN_FILENO)
+    close(in->fd);
+  freebuffer(in->scratch);
+  free(in);
+}
+
+/* reads the next block, returning NO at the end of the input */
+static bool fill(reader *in) {
+  ssize_t n;
+  if (in->eof)
+    return NO;
+  do
+    n = read(in->fd, in->data, in->size);
+  while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    in->eof = YES;
+    return NO;
   }
-  bufferappend(&buf, 0);
-  ref_t result = string(bufferstring(buf));
-  freebuffer(buf);
-  return result;
+  in->pos = in->data, in->end = in->data + n;
+  return YES;
 }
 
-static void readtoken(int ch, FILE *in, buffer *buf) {
+static int skipcomment(reader *in) {
+  const char *newline;
   do {
-    bufferappend(&buf, ch);
-    ch = getc(in);
-    if (ch == ')') {
-      ungetc(ch, in);
+    newline = memchr(in->pos, '\n', in->end - in->pos);
+    if (newline) {
+      in->pos = newline + 1;
+      return '\n';
+    }
+    in->pos = in->end;
+  } while (fill(in));
+  return EOF;
+}
+
+static int skipspace(reader *in) {
+  for (;;) {
+    in->pos = scan_space(in->pos, in->end);
+    if (in->pos == in->end) {
+      if (!fill(in))
+        return EOF;
+    } else if (*in->pos == ';') {
+      in->pos++;
+      if (skipcomment(in) == EOF)
+        return EOF;
+    } else
+      return (unsigned char) *in->pos++;
+  }
+}
+
+/* a string within one block is copied straight into its object; only
+   one that runs past the end of a block goes through scratch */
+static ref_t readstring(reader *in) {
+  const char *start = in->pos, *quote = memchr(in->pos, '"', in->end - in->pos);
+  if (quote) {
+    in->pos = quote + 1;
+    return string_from_bytes(start, quote - start);
+  }
+  bufferreset(in->scratch);
+  for (;;) {
+    quote = memchr(in->pos, '"', in->end - in->pos);
+    bufferappendbytes(&in->scratch, in->pos, (quote ? quote : in->end) - in->pos);
+    if (quote) {
+      in->pos = quote + 1;
       break;
     }
-  } while (!isspace(ch));
-  bufferappend(&buf, 0);
-}
-
-static bool isident(const char *token) {
-  static bool initialized = NO;
-  static bool map[CHAR_MAX];
-  size_t i, len = strlen(token);
-  if (!initialized) {
-    int c;
-    for (c = 0; c <= CHAR_MAX; c++)
-      map[c] = NO;
-    for (c = 'a'; c <= 'z'; c++)
-      map[c] = YES;
-    for (c = 'A'; c <= 'Z'; c++)
-      map[c] = YES;
-    for (c = '0'; c <= '9'; c++)
-      map[c] = YES;
-    map['!'] = map['&'] = map['+'] = map['?'] =
-      map['^'] = map['_'] = map['-'] = map['<'] =
-      map['>'] = map['$'] = map['='] = map['.'] =
-      map['%'] = map['*'] = map['/'] = map['~'] = YES;
+    in->pos = in->end;
+    if (!fill(in))
+      error("end of file reached before end of string");
   }
-  for (i = 0; i < len; i++) {
-    if (!map[(int) token[i]])
-      return NO;
+  return string_from_bytes(bufferstring(in->scratch), bufferlen(in->scratch));
+}
+
+/**
+ * Returns the token whose first byte was just read, and the classes of
+ * the bytes after that one. A token that lies within one block is
+ * left where it is; one that does not is copied into the scratch
+ * buffer. Either way it is good until the next one is read.
+ */
+static const char *readtoken(reader *in, size_t *length, int *classes) {
+  const char *start = in->pos - 1;
+  *classes = 0;
+  in->pos = scan_token(in->pos, in->end, classes);
+  if (in->pos < in->end || in->eof) {
+    *length = in->pos - start;
+    return start;
   }
-  return YES;
+  bufferreset(in->scratch);
+  for (;;) {
+    bufferappendbytes(&in->scratch, start, in->pos - start);
+    if (in->pos < in->end || !fill(in))
+      break;
+    start = in->pos;
+    in->pos = scan_token(in->pos, in->end, classes);
+  }
+  *length = bufferlen(in->scratch);
+  bufferappend(&in->scratch, 0);
+  return bufferstring(in->scratch);
 }
 
-static ref_t parsetoken(const char *token) {
+/* a token as a C string, copied into the scratch buffer if need be */
+static const char *terminate(reader *in, const char *token, size_t length) {
+  if (token == bufferstring(in->scratch))
+    return token;
+  bufferreset(in->scratch);
+  bufferappendbytes(&in->scratch, token, length);
+  bufferappend(&in->scratch, 0);
+  return bufferstring(in->scratch);
+}
+
+/* decimal integers that fit in 64 bits are the common case, so they
+   are converted straight from the token */
+static inline bool isshortdecimal(const char *token, size_t length, int classes) {
+  bool sign = token[0] == '-' || token[0] == '+';
+  size_t digits = length - sign;
+  if (classes & SCAN_NONDIGIT || digits == 0 || digits > 18)
+    return NO;
+  /* a leading zero means octal */
+  return (sign || isdigit(token[0])) && (token[sign] != '0' || digits == 1);
+}
+
+static ref_t parsedecimal(const char *token, size_t length) {
+  const char *p = token, *end = token + length;
+  int64_t val = 0;
+  if (*p == '-' || *p == '+')
+    p++;
+  for (; p < end; p++)
+    val = val * 10 + (*p - '0');
+  return integer(token[0] == '-' ? -val : val);
+}
+
+static ref_t parsetoken(reader *in, const char *token, size_t length, int classes) {
+  if (isshortdecimal(token, length, classes))
+    return parsedecimal(token, length);
+  token = terminate(in, token, length);
   if (token[0] == ':') {
     ref_t symbol = intern(token);
     set_value(symbol, symbol);
@@ -82,58 +207,85 @@ static ref_t parsetoken(const char *token) {
     return NIL;
   if (!strcmp("true", token))
     return TRUE;
-  if (token[0] == '-' || token[0] == '+' || isdigit(token[0])) {
+  if (token[0] == '-' || token[0] == '+' || token[0] == '.' || isdigit(token[0])) {
     char *end = NULL;
-    long int val = strtol(token, &end, 0);
+    long long val;
+    double d;
+    errno = 0;
+    val = strtoll(token, &end, 0);
     if (!*end)
-      return integer(val);
+      return errno == ERANGE ? integer_from_string(token) : integer(val);
+    /* strtod would also take things like inf and hex, which are
+       symbols, and a flonum needs a point or an exponent */
+    if (strspn(token, "0123456789+-.eE") == length && strpbrk(token, ".eE")) {
+      d = strtod(token, &end);
+      if (!*end)
+        return flonum(d);
+    }
   }
-  if (isident(token))
+  if (!((classes | scan_classes(token[0])) & SCAN_NONIDENT))
     return intern(token);
   error("invalid token: '%s'", token);
   return NIL;
 }
 
-static ref_t readnext(int ch, FILE *in);
-
-static ref_t readseq(bool islist, FILE *in) {
-  int ch = skipspace(in);
-  if (ch == EOF && islist)
-      error("end of file reached before end of list");
-  else if (ch == EOF || (islist && ch == ')'))
-    return NIL;
-  ref_t car = readnext(ch, in);
-  ref_t cdr = readseq(islist, in);
-  return cons(car, cdr);
-}
+static ref_t readnext(int ch, reader *in);
 
-static inline ref_t readlist(FILE *in) {
-  return readseq(YES, in);
+/* reads up to the closing paren, appending to the tail so only
+   nested lists recurse */
+static ref_t readlist(reader *in) {
+  ref_t head = NIL, tail = NIL, cell;
+  int ch;
+  while ((ch = skipspace(in)) != EOF && ch != ')') {
+    cell = cons(readnext(ch, in), NIL);
+    if (isnil(head))
+      head = cell;
+    else
+      set_cdr(tail, cell);
+    tail = cell;
+  }
+  if (ch == EOF)
+    error("end of file reached before end of list");
+  return head;
 }
 
-static ref_t readnext(int ch, FILE *in) {
+static ref_t readnext(int ch, reader *in) {
   if (ch == '(')
     return readlist(in);
   else if (ch == '"')
     return readstring(in);
-  else if (ch == '\'')
-    return cons(intern("quote"), cons(readnext(skipspace(in), in), NIL));
+  else if (ch == '\'') {
+    if ((ch = skipspace(in)) == EOF)
+      error("unexpected end of input");
+    return cons(intern("quote"), cons(readnext(ch, in), NIL));
+  }
   else {
-    buffer *buf = allocbuffer();
-    readtoken(ch, in, buf);
-    ref_t result = parsetoken(bufferstring(buf));
-    freebuffer(buf);
-    return result;
+    size_t length;
+    int classes;
+    const char *token = readtoken(in, &length, &classes);
+    return parsetoken(in, token, length, classes);
   }
 }
 
-ref_t readsexp(FILE *in) {
+ref_t readform(reader *in) {
   int ch = skipspace(in);
-  if (ch == EOF)
+  return ch == EOF ? UNBOUND : readnext(ch, in);
+}
+
+ref_t readsexp(reader *in) {
+  ref_t form = readform(in);
+  if (form == UNBOUND)
     exit(0);
-  return readnext(ch, in);
+  return form;
+}
+
+const char *peekbytes(reader *in, size_t *length) {
+  if (in->pos == in->end && !fill(in))
+    return NULL;
+  *length = in->end - in->pos;
+  return in->pos;
 }
 
-ref_t readstream(FILE *in) {
-  return readseq(NO, in);
+void skipbytes(reader *in, size_t n) {
+  in->pos += n;
 }
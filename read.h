@@ -1,11 +1,24 @@
 #ifndef READ_H
 #define READ_H
 
-#include <stdio.h>
 #include "env.h"
 #include "types.h"
 
-ref_t readsexp(FILE *in);
-ref_t readstream(FILE *in);
+typedef struct reader reader;
+
+/* "-" is the standard input; returns NULL if the file cannot be opened */
+reader *openreader(const char *filename);
+void closereader(reader *in);
+
+/* the next form, or UNBOUND at the end of the input */
+ref_t readform(reader *in);
+/* the next form, exiting at the end of the input */
+ref_t readsexp(reader *in);
+
+/* the unread bytes up to the end of the current block, reading the
+   next if there are none, or NULL at the end of the input */
+const char *peekbytes(reader *in, size_t *length);
+/* marks n of those bytes read */
+void skipbytes(reader *in, size_t n);
 
 #endif
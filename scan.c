@@ -0,0 +1,119 @@
+#include "scan.h"
+#include "types.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define DIGIT 1
+#define IDENT 2
+#define SPACE 4
+#define DELIM 8
+
+static const unsigned char table[256] = {
+  ['0' ... '9'] = DIGIT | IDENT,
+  ['a' ... 'z'] = IDENT,
+  ['A' ... 'Z'] = IDENT,
+  ['!'] = IDENT, ['$' ... '&'] = IDENT, ['*' ... '+'] = IDENT,
+  ['-' ... '/'] = IDENT, ['<' ... '?'] = IDENT, ['^' ... '_'] = IDENT,
+  ['~'] = IDENT,
+  ['\t' ... '\r'] = SPACE | DELIM, [' '] = SPACE | DELIM,
+  [')'] = DELIM
+};
+
+static inline int classes_of(unsigned char seen) {
+  return (seen & DIGIT ? 0 : SCAN_NONDIGIT) | (seen & IDENT ? 0 : SCAN_NONIDENT);
+}
+
+int scan_classes(char ch) {
+  return classes_of(table[(unsigned char) ch]);
+}
+
+#if defined(__AVX2__)
+typedef __m256i vec;
+#define WIDTH 32
+#define LOAD(p) _mm256_loadu_si256((const __m256i *) (p))
+#define SET1 _mm256_set1_epi8
+#define EQ _mm256_cmpeq_epi8
+#define GT _mm256_cmpgt_epi8
+#define AND _mm256_and_si256
+#define OR _mm256_or_si256
+#define MASK(v) ((uint32_t) _mm256_movemask_epi8(v))
+#elif defined(__SSE2__)
+typedef __m128i vec;
+#define WIDTH 16
+#define LOAD(p) _mm_loadu_si128((const __m128i *) (p))
+#define SET1 _mm_set1_epi8
+#define EQ _mm_cmpeq_epi8
+#define GT _mm_cmpgt_epi8
+#define AND _mm_and_si128
+#define OR _mm_or_si128
+#define MASK(v) ((uint32_t) _mm_movemask_epi8(v))
+#endif
+
+#ifdef WIDTH
+#define ALL ((uint32_t) ((1ULL << WIDTH) - 1))
+
+/* the comparisons are signed, so bytes above 0x7F are in no range */
+static inline vec between(vec v, char lo, char hi) {
+  return AND(GT(v, SET1(lo - 1)), GT(SET1(hi + 1), v));
+}
+
+static inline vec space(vec v) {
+  return OR(between(v, '\t', '\r'), EQ(v, SET1(' ')));
+}
+
+static inline vec ident(vec v, vec digit) {
+  vec alpha = between(OR(v, SET1(0x20)), 'a', 'z');
+  vec punct = OR(OR(EQ(v, SET1('!')), EQ(v, SET1('~'))),
+                 OR(OR(between(v, '$', '&'), between(v, '*', '+')),
+                    OR(OR(between(v, '-', '/'), between(v, '<', '?')),
+                       between(v, '^', '_'))));
+  return OR(OR(alpha, digit), punct);
+}
+#endif
+
+const char *scan_space(const char *p, const char *end) {
+#ifdef WIDTH
+  uint32_t other;
+  for (; end - p >= WIDTH; p += WIDTH) {
+    other = ~MASK(space(LOAD(p))) & ALL;
+    if (other)
+      return p + __builtin_ctz(other);
+  }
+#endif
+  while (p < end && (table[(unsigned char) *p] & SPACE))
+    p++;
+  return p;
+}
+
+const char *scan_token(const char *p, const char *end, int *classes) {
+  unsigned char seen = DIGIT | IDENT;
+#ifdef WIDTH
+  uint32_t stop, within, nondigit = 0, nonident = 0;
+  vec v, digit;
+  for (; end - p >= WIDTH; p += WIDTH) {
+    v = LOAD(p);
+    digit = between(v, '0', '9');
+    stop = MASK(OR(space(v), EQ(v, SET1(')'))));
+    within = stop ? (1U << __builtin_ctz(stop)) - 1 : ALL;
+    nondigit |= ~MASK(digit) & within;
+    nonident |= ~MASK(ident(v, digit)) & within;
+    if (stop) {
+      p += __builtin_ctz(stop);
+      break;
+    }
+  }
+  if (nondigit)
+    seen &= ~DIGIT;
+  if (nonident)
+    seen &= ~IDENT;
+  if (end - p < WIDTH)
+#endif
+    for (; p < end && !(table[(unsigned char) *p] & DELIM); p++)
+      seen &= table[(unsigned char) *p];
+  *classes |= classes_of(seen);
+  return p;
+}
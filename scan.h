@@ -0,0 +1,27 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <sys/types.h>
+
+/**
+ * Finding token boundaries in the reader's input. These look at 32
+ * bytes at a time with AVX2, 16 with SSE2, and one at a time on
+ * anything else. Whitespace is the C locale's, and a token ends at
+ * whitespace or a close paren.
+ */
+
+/* the first byte from p that is not whitespace, or end */
+const char *scan_space(const char *p, const char *end);
+
+/* what was seen in the bytes of a token */
+#define SCAN_NONDIGIT 1
+#define SCAN_NONIDENT 2
+
+/* the classes of a single byte */
+int scan_classes(char ch);
+
+/* the end of the token running from p, or end if it gets that far,
+   or'ing the classes of its bytes into classes */
+const char *scan_token(const char *p, const char *end, int *classes);
+
+#endif
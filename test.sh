@@ -4,7 +4,8 @@ for test in ${@:-*.test.ol}; do
     printf "%s..." $(basename $test .test.ol)
     expected=$(sed -e '1,/RESULT/d' -e '/^$/d'< $test)
     actual=$(sed -e '/RESULT/,$d' -e '/^$/d' < $test | ${program:=$PWD/object -d -} 2>&1)
-    if [ $? -ne 0 ]; then
+    # a test whose result is an error expects the program to fail
+    if [ $? -ne 0 ] && [ "${expected#ERROR: }" = "$expected" ]; then
         status=1
         echo ERROR
         echo "  $actual"
@@ -5,7 +5,7 @@
 #include <sys/types.h>
 
 typedef unsigned long ref_t;
-typedef void (*fn_t)();
+typedef ref_t (*fn_t)(ref_t *args);
 
 typedef enum {
   NO = 0,
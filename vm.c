@@ -0,0 +1,220 @@
+#include <assert.h>
+#include <stdlib.h>
+#include "alloc.h"
+#include "compile.h"
+#include "error.h"
+#include "eval.h"
+#include "frame.h"
+#include "gc.h"
+#include "object.h"
+#include "vm.h"
+
+/**
+ * The VM keeps its values on one stack and its activations on
+ * another. An activation records the code it is running, how far it
+ * has got, and the frame its variables live in. Both stacks are
+ * traced by the collector, which may move the code, so the run loop
+ * reloads its registers after anything that can reach a safepoint.
+ */
+struct activation {
+  ref_t code, env;
+  size_t pc;
+};
+
+static ref_t *stack = NULL;
+static size_t sp = 0, stack_size = 0;
+
+static struct activation *frames = NULL;
+static size_t fp = 0, frames_size = 0;
+
+static inline void push(ref_t obj) {
+  if (sp == stack_size) {
+    stack_size = stack_size ? stack_size * 2 : 1024;
+    stack = safe_realloc(stack, stack_size * sizeof(ref_t));
+  }
+  stack[sp++] = obj;
+}
+
+static inline void push_frame(ref_t code, ref_t env) {
+  if (fp == frames_size) {
+    frames_size = frames_size ? frames_size * 2 : 256;
+    frames = safe_realloc(frames, frames_size * sizeof(struct activation));
+  }
+  frames[fp].code = code, frames[fp].env = env, frames[fp].pc = 0;
+  fp++;
+}
+
+bool iscompiled(ref_t func) {
+  return !isbuiltin(func) && isbytecode(getcode(func));
+}
+
+/* replaces (apply f args) on the stack with f and the elements of args */
+static ref_t spread(size_t *n) {
+  ref_t func, args;
+  if (*n != 2)
+    argument_error(*n);
+  func = check_function(stack[sp - 2]), args = check_list(stack[sp - 1]);
+  sp -= 3;
+  push(func);
+  for (*n = 0; !isnil(args); args = cdr(args), (*n)++)
+    push(car(args));
+  return func;
+}
+
+/* calls the function below the top n values, either starting an
+   activation for it or leaving its value in place of the call; a
+   tail call reuses the activation of its caller */
+static void call(size_t n, bool tail) {
+  ref_t func = check_function(stack[sp - n - 1]), args = NIL, env;
+  size_t i, arity;
+  while (isapply(func))
+    func = spread(&n);
+  check_arity(func, n);
+  if (iscompiled(func)) {
+    env = make_frame(func, stack + sp - n, n);
+    sp -= n + 1;
+    if (tail)
+      fp--;
+    push_frame(getcode(func), env);
+    return;
+  }
+  if (isbuiltin(func) && !iscontrol(func)) {
+    /* the arguments are passed straight from the stack */
+    arity = getarity(func);
+    if (hasrest(func)) {
+      for (i = n; i > arity; i--)
+        args = cons(stack[--sp], args);
+      push(args);
+    }
+    n = arity + hasrest(func);
+    args = getfn(func)(stack + sp - n);
+    sp -= n;
+    stack[sp - 1] = args;
+    return;
+  }
+  for (i = 0; i < n; i++)
+    args = cons(stack[--sp], args);
+  /* the stack can be reallocated while func runs */
+  args = apply_function(func, args);
+  stack[sp - 1] = args;
+}
+
+/* returns the code for a call site whose function is a macro */
+static ref_t expand(ref_t site, ref_t func) {
+  ref_t form, code = site_code(site);
+  size_t epoch = macro_epoch();
+  if (code != UNBOUND)
+    return code;
+  push(site);
+  form = apply_function(func, cdr(site_form(site)));
+  site = stack[--sp];
+  code = compile(form, site_scope(site));
+  set_site_code(site, code, epoch);
+  return code;
+}
+
+static void run(size_t depth) {
+  const int *ops;
+  ref_t consts, env, obj;
+  size_t pc;
+  int i;
+  bool tail;
+#define LOAD() (ops = bytecode_ops(frames[fp - 1].code), \
+                consts = bytecode_consts(frames[fp - 1].code), \
+                env = frames[fp - 1].env, pc = frames[fp - 1].pc)
+#define SAVE(next) (frames[fp - 1].pc = (next))
+  LOAD();
+  for (;;) {
+    switch (ops[pc++]) {
+    case OP_CONST:
+      push(vector_ref(consts, ops[pc++]));
+      break;
+    case OP_LOCAL:
+      i = ops[pc++];
+      push(frame_ref(env, i, ops[pc++]));
+      break;
+    case OP_GLOBAL:
+      push(get_value(vector_ref(consts, ops[pc++])));
+      break;
+    case OP_POP:
+      sp--;
+      break;
+    case OP_JUMP:
+      pc = (size_t) ops[pc];
+      break;
+    case OP_JUMP_IF_NIL:
+      pc = isnil(stack[--sp]) ? (size_t) ops[pc] : pc + 1;
+      break;
+    case OP_FUNCTION:
+      obj = site_function(vector_ref(consts, ops[pc]));
+      if (!ismacro(obj)) {
+        push(obj);
+        pc += 2;
+        break;
+      }
+      /* the expansion can collect, moving the code */
+      tail = ops[ops[pc + 1]] == OP_RETURN;
+      SAVE(ops[pc + 1]);
+      obj = expand(vector_ref(consts, ops[pc]), obj);
+      if (tail)
+        frames[fp - 1].code = obj, frames[fp - 1].pc = 0;
+      else
+        push_frame(obj, frames[fp - 1].env);
+      LOAD();
+      break;
+    case OP_CALL:
+      /* the collection can move the code */
+      SAVE(pc + 1);
+      i = ops[pc], tail = ops[pc + 1] == OP_RETURN;
+      gc_safepoint();
+      call(i, tail);
+      LOAD();
+      break;
+    case OP_CLOSURE:
+      push(instantiate(vector_ref(consts, ops[pc++]), env));
+      break;
+    case OP_RETURN:
+      if (--fp == depth)
+        return;
+      LOAD();
+      break;
+    default:
+      abort();
+    }
+  }
+#undef LOAD
+#undef SAVE
+}
+
+ref_t vm_apply(ref_t func, ref_t args) {
+  size_t depth = fp, n = 0;
+  push(func);
+  for (; !isnil(args); args = cdr(args), n++)
+    push(car(args));
+  call(n, NO);
+  if (fp > depth)
+    run(depth);
+  return stack[--sp];
+}
+
+void vm_eval() {
+  sp = fp = 0;
+  reset_eval();
+  push_frame(compile(expr, NIL), NIL);
+  run(0);
+  expr = stack[--sp];
+}
+
+static void trace_vm(gc_visit_t visit) {
+  size_t i;
+  for (i = 0; i < sp; i++)
+    visit(&stack[i]);
+  for (i = 0; i < fp; i++) {
+    visit(&frames[i].code);
+    visit(&frames[i].env);
+  }
+}
+
+void init_vm() {
+  gc_tracer(trace_vm);
+}
@@ -0,0 +1,33 @@
+#ifndef VM_H
+#define VM_H
+
+#include "types.h"
+
+/**
+ * Instructions are ints, each opcode followed by its operands. Code
+ * for a function runs with the function's frame as its environment
+ * and leaves exactly one value on the stack when it returns.
+ */
+typedef enum {
+  OP_CONST,       /* k: push constant k */
+  OP_LOCAL,       /* depth index: push a slot of an enclosing frame */
+  OP_GLOBAL,      /* k: push the value of the symbol in constant k */
+  OP_POP,         /* discard the top of the stack */
+  OP_JUMP,        /* target */
+  OP_JUMP_IF_NIL, /* target: pop, and jump if it was nil */
+  OP_FUNCTION,    /* k target: push the function named by call site k,
+                     or run the site's macro expansion and jump */
+  OP_CALL,        /* n: call the function below the top n values */
+  OP_CLOSURE,     /* k: instantiate the template in constant k */
+  OP_RETURN
+} opcode_t;
+
+void init_vm();
+
+/* compiles and runs expr, leaving its value in expr */
+void vm_eval();
+
+ref_t vm_apply(ref_t func, ref_t args);
+bool iscompiled(ref_t func);
+
+#endif
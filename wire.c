@@ -0,0 +1,375 @@
+#include <stdlib.h>
+#include <string.h>
+#include "alloc.h"
+#include "buffer.h"
+#include "env.h"
+#include "error.h"
+#include "object.h"
+#include "wire.h"
+
+/**
+ * Every value starts with a tag byte. Counts and fixnums follow as
+ * little-endian base 128 varints, fixnums zigzagged so that small
+ * negatives stay short. A list is its length and its elements, and a
+ * dotted list is followed by its tail.
+ */
+enum wire_tag {
+  W_NIL = 1, W_TRUE, W_FIXNUM, W_STRING, W_SYMBOL, W_SYMREF, W_LIST, W_DOTTED
+};
+
+/* the longest varint and the tag before it */
+#define MAX_HEAD 11
+
+static inline size_t putvarint(char *p, uint64_t n) {
+  size_t i = 0;
+  for (; n >= 0x80; n >>= 7)
+    p[i++] = (char) (n | 0x80);
+  p[i++] = (char) n;
+  return i;
+}
+
+static inline void puttag(sink *out, enum wire_tag tag) {
+  char byte = tag;
+  sinkwrite(out, &byte, 1);
+}
+
+static inline void puthead(sink *out, enum wire_tag tag, uint64_t n) {
+  char head[MAX_HEAD];
+  head[0] = tag;
+  sinkwrite(out, head, 1 + putvarint(head + 1, n));
+}
+
+/**
+ ** Encoding
+ **/
+
+/* the symbols written so far, numbered in the order they were; an
+   entry belongs to the current value only if it has its stamp */
+struct entry {
+  ref_t symbol;
+  size_t index;
+  unsigned stamp;
+};
+static struct entry *written = NULL;
+static size_t written_size = 0, nwritten = 0;
+static unsigned stamp = 0;
+
+static size_t find_written(ref_t sym) {
+  size_t mask = written_size - 1, i = symbol_hash(sym) & mask;
+  while (written[i].stamp == stamp && written[i].symbol != sym)
+    i = (i + 1) & mask;
+  return i;
+}
+
+static void grow_written() {
+  struct entry *old = written;
+  size_t i, size = written_size;
+  written_size = size ? size * 2 : 256;
+  written = safe_malloc(written_size * sizeof(struct entry));
+  memset(written, 0, written_size * sizeof(struct entry));
+  for (i = 0; i < size; i++) {
+    if (old[i].stamp == stamp)
+      written[find_written(old[i].symbol)] = old[i];
+  }
+  free(old);
+}
+
+static void forget_written() {
+  nwritten = 0;
+  if (!written)
+    grow_written();
+  if (++stamp == 0) {
+    memset(written, 0, written_size * sizeof(struct entry));
+    stamp = 1;
+  }
+}
+
+static bool isencodable(ref_t obj) {
+  return isnil(obj) || istrue(obj) || isfixnum(obj) || isstring(obj) ||
+    isbuilder(obj) || issymbol(obj);
+}
+
+static void encodeatom(sink *out, ref_t obj) {
+  const char *name;
+  int64_t i;
+  size_t slot;
+  if (isnil(obj))
+    puttag(out, W_NIL);
+  else if (istrue(obj))
+    puttag(out, W_TRUE);
+  else if (isfixnum(obj)) {
+    i = intvalue(obj);
+    puthead(out, W_FIXNUM, ((uint64_t) i << 1) ^ (uint64_t) (i >> 63));
+  } else if (isstring(obj) || isbuilder(obj)) {
+    obj = flatten(obj);
+    puthead(out, W_STRING, string_length(obj));
+    sinkwrite(out, strvalue(obj), string_length(obj));
+  } else if (issymbol(obj)) {
+    slot = find_written(obj);
+    if (written[slot].stamp == stamp) {
+      puthead(out, W_SYMREF, written[slot].index);
+      return;
+    }
+    written[slot].symbol = obj;
+    written[slot].index = nwritten++;
+    written[slot].stamp = stamp;
+    if (2 * nwritten > written_size)
+      grow_written();
+    name = strvalue(obj);
+    puthead(out, W_SYMBOL, strlen(name));
+    sinkwrite(out, name, strlen(name));
+  } else
+    error("cannot encode object");
+}
+
+/* the lists being encoded, as in printto */
+static ref_t *open_lists = NULL;
+static size_t open_size = 0;
+
+/* encodes obj, or with no sink only checks that it can be */
+static void walk(sink *out, ref_t obj) {
+  size_t depth = 0, count;
+  ref_t rest;
+  for (;;) {
+    if (isvarref(obj))
+      obj = varref_symbol(obj);
+    else if (issite(obj))
+      obj = site_form(obj);
+    if (iscons(obj)) {
+      if (depth == open_size) {
+        open_size = open_size ? open_size * 2 : 64;
+        open_lists = safe_realloc(open_lists, open_size * sizeof(ref_t));
+      }
+      if (out) {
+        for (count = 0, rest = obj; iscons(rest); rest = cdr(rest))
+          count++;
+        puthead(out, isnil(rest) ? W_LIST : W_DOTTED, count);
+      }
+      open_lists[depth++] = obj;
+      obj = car(obj);
+      continue;
+    }
+    if (out)
+      encodeatom(out, obj);
+    else if (!isencodable(obj))
+      error("cannot encode object");
+    for (; depth > 0; depth--) {
+      rest = open_lists[depth - 1];
+      if (rest != UNBOUND && !isnil(rest = cdr(rest)))
+        break;
+    }
+    if (depth == 0)
+      return;
+    open_lists[depth - 1] = iscons(rest) ? rest : UNBOUND;
+    obj = iscons(rest) ? car(rest) : rest;
+  }
+}
+
+void encodeto(sink *out, ref_t obj) {
+  forget_written();
+  walk(out, obj);
+}
+
+void check_encodable(ref_t obj) {
+  walk(NULL, obj);
+}
+
+ref_t encode(ref_t obj) {
+  static sink *out = NULL;
+  const char *bytes;
+  size_t length;
+  if (!out)
+    out = memorysink();
+  resetsink(out);
+  encodeto(out, obj);
+  bytes = sinkbytes(out, &length);
+  return string_from_bytes(bytes, length);
+}
+
+/**
+ ** Decoding
+ **/
+
+/* bytes in memory, or a reader's current block */
+struct source {
+  const char *start, *pos, *end;
+  reader *in;
+};
+
+/* moves on to the reader's next block, returning NO at the end */
+static bool more(struct source *src) {
+  size_t length;
+  if (!src->in)
+    return NO;
+  skipbytes(src->in, src->end - src->start);
+  src->start = src->pos = src->end = peekbytes(src->in, &length);
+  if (!src->start)
+    return NO;
+  src->end += length;
+  return YES;
+}
+
+/* the bytes left in the current block; pos never passes end */
+static inline size_t available(struct source *src) {
+  return (size_t) (src->end - src->pos);
+}
+
+static inline unsigned char getbyte(struct source *src) {
+  if (src->pos == src->end && !more(src))
+    error("truncated encoding");
+  return *src->pos++;
+}
+
+static uint64_t getvarint(struct source *src) {
+  uint64_t n = 0;
+  unsigned char byte;
+  int shift = 0;
+  do {
+    if (shift > 63)
+      error("bad encoding");
+    byte = getbyte(src);
+    n |= (uint64_t) (byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return n;
+}
+
+/* n bytes, terminated, in a buffer that is reused */
+static const char *getbytes(struct source *src, size_t n) {
+  static buffer *scratch = NULL;
+  size_t run;
+  if (!scratch)
+    scratch = allocbuffer();
+  bufferreset(scratch);
+  while (n > 0) {
+    if (src->pos == src->end && !more(src))
+      error("truncated encoding");
+    run = available(src) < n ? available(src) : n;
+    bufferappendbytes(&scratch, src->pos, run);
+    src->pos += run, n -= run;
+  }
+  bufferappend(&scratch, 0);
+  return bufferstring(scratch);
+}
+
+/* the symbols read so far, by number */
+static ref_t *seen = NULL;
+static size_t nseen = 0, seen_size = 0;
+
+/**
+ * Lists are built without recursing. Each one still being read keeps
+ * its first and last cells and how many elements it is still owed; a
+ * dotted list owed none is waiting for its tail.
+ */
+struct frame {
+  ref_t head, last;
+  size_t remaining;
+  bool dotted;
+};
+static struct frame *frames = NULL;
+static size_t frames_size = 0;
+
+static ref_t decodevalue(struct source *src) {
+  size_t depth = 0, i;
+  unsigned char tag;
+  struct frame *top;
+  ref_t value = NIL, cell;
+  nseen = 0;
+  for (;;) {
+    switch (tag = getbyte(src)) {
+    case W_NIL:
+      value = NIL;
+      break;
+    case W_TRUE:
+      value = TRUE;
+      break;
+    case W_FIXNUM:
+      i = getvarint(src);
+      value = integer((int64_t) (i >> 1) ^ -(int64_t) (i & 1));
+      break;
+    case W_STRING:
+      i = getvarint(src);
+      if (available(src) >= i) {
+        value = string_from_bytes(src->pos, i);
+        src->pos += i;
+      } else
+        value = string_from_bytes(getbytes(src, i), i);
+      break;
+    case W_SYMBOL:
+      i = getvarint(src);
+      value = intern(getbytes(src, i));
+      if (strvalue(value)[0] == ':')
+        set_value(value, value);
+      if (nseen == seen_size) {
+        seen_size = seen_size ? seen_size * 2 : 256;
+        seen = safe_realloc(seen, seen_size * sizeof(ref_t));
+      }
+      seen[nseen++] = value;
+      break;
+    case W_SYMREF:
+      if ((i = getvarint(src)) >= nseen)
+        error("bad encoding");
+      value = seen[i];
+      break;
+    case W_LIST:
+    case W_DOTTED:
+      if ((i = getvarint(src)) == 0)
+        error("bad encoding");
+      if (depth == frames_size) {
+        frames_size = frames_size ? frames_size * 2 : 64;
+        frames = safe_realloc(frames, frames_size * sizeof(struct frame));
+      }
+      top = &frames[depth++];
+      top->head = top->last = NIL;
+      top->remaining = i;
+      top->dotted = tag == W_DOTTED;
+      continue;
+    default:
+      error("bad encoding");
+    }
+    for (;;) {
+      if (depth == 0)
+        return value;
+      top = &frames[depth - 1];
+      if (top->remaining == 0) {
+        set_cdr(top->last, value);
+      } else {
+        cell = cons(value, NIL);
+        if (isnil(top->head))
+          top->head = cell;
+        else
+          set_cdr(top->last, cell);
+        top->last = cell;
+        if (--top->remaining > 0 || top->dotted)
+          break;
+      }
+      value = top->head;
+      depth--;
+    }
+  }
+}
+
+ref_t decodefrom(reader *in) {
+  struct source src;
+  size_t length;
+  ref_t value;
+  if (!(src.start = peekbytes(in, &length)))
+    return UNBOUND;
+  src.pos = src.start, src.end = src.start + length;
+  src.in = in;
+  value = decodevalue(&src);
+  skipbytes(in, src.pos - src.start);
+  return value;
+}
+
+ref_t decode(ref_t str) {
+  struct source src;
+  ref_t value;
+  src.start = src.pos = strvalue(check_string(str));
+  src.end = src.pos + string_length(str);
+  src.in = NULL;
+  value = decodevalue(&src);
+  if (src.pos != src.end)
+    error("bad encoding");
+  return value;
+}
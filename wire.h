@@ -0,0 +1,26 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include "print.h"
+#include "read.h"
+#include "types.h"
+
+/**
+ * A binary encoding of data for passing between processes: nil,
+ * true, fixnums, strings, symbols and lists of them. Each symbol's
+ * name is written once per value and referred to by number after
+ * that. Decoding raises an error on anything that is not an encoding.
+ */
+void encodeto(sink *out, ref_t obj);
+
+/* raises the error encodeto would, without writing anything */
+void check_encodable(ref_t obj);
+
+/* the next value encoded in the input, or UNBOUND at its end */
+ref_t decodefrom(reader *in);
+
+/* to and from the bytes of a string */
+ref_t encode(ref_t obj);
+ref_t decode(ref_t str);
+
+#endif